@@ -0,0 +1,280 @@
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "BVH.h"
+#include "Object.h"
+#include "Ray.h"
+#include "RayPacket.h"
+
+using namespace std;
+
+BVH::BVH(const vector<Object *> &objects):
+    objects(objects),
+    nbObjects(0)
+{}
+
+BoundingBox BVH::getBoundingBox(const Object *o) {
+    // Translations keep boxes in between those at both ends
+    BoundingBox box = o->getWorldBoundingBox();
+    if(o->isMobile())
+        box.extendTo(box.translate(o->getMobile()));
+    return box;
+}
+
+void BVH::build() {
+    nodes.clear();
+    nbObjects = objects.size();
+    if(objects.empty())
+        return;
+
+    vector<unsigned> indices(objects.size());
+    for(unsigned i = 0 ; i < indices.size() ; i++)
+        indices[i] = i;
+
+    nodes.reserve(2*objects.size()-1);
+    nodes.resize(1);
+    build(0, indices, 0, indices.size(), 0);
+}
+
+void BVH::build(unsigned node, vector<unsigned> &indices,
+                unsigned begin, unsigned end, unsigned depth) {
+    BoundingBox box = getBoundingBox(objects[indices[begin]]);
+    BoundingBox centers(box.getCenter());
+    for(unsigned i = begin+1 ; i < end ; i++) {
+        BoundingBox b = getBoundingBox(objects[indices[i]]);
+        box.extendTo(b);
+        centers.extendTo(b.getCenter());
+    }
+    nodes[node].bBox = box;
+
+    if(end-begin == 1 || depth+1 >= MAX_DEPTH) {
+        // Too deep should never happen with median splits
+        nodes[node].leaf = true;
+        nodes[node].index = indices[begin];
+        return;
+    }
+
+    // Median of the centers along their widest axis
+    Vec3Df delta = centers.getMax()-centers.getMin();
+    unsigned axis = 0;
+    if(delta[1] > delta[axis]) axis = 1;
+    if(delta[2] > delta[axis]) axis = 2;
+
+    unsigned middle = (begin+end)/2;
+    nth_element(indices.begin()+begin, indices.begin()+middle, indices.begin()+end,
+                [&](unsigned a, unsigned b) {
+                    return getBoundingBox(objects[a]).getMiddle(axis) <
+                           getBoundingBox(objects[b]).getMiddle(axis);
+                });
+
+    unsigned sons = nodes.size();
+    nodes.resize(sons+2);
+    nodes[node].leaf = false;
+    nodes[node].index = sons;
+
+    build(sons, indices, begin, middle, depth+1);
+    build(sons+1, indices, middle, end, depth+1);
+}
+
+void BVH::refit() {
+    // Sons always come after their father
+    for(unsigned i = nodes.size() ; i-- > 0 ;) {
+        Node &n = nodes[i];
+        if(n.isLeaf()) {
+            n.bBox = getBoundingBox(objects[n.getObject()]);
+        }
+        else {
+            n.bBox = nodes[n.getLeft()].bBox;
+            n.bBox.extendTo(nodes[n.getRight()].bBox);
+        }
+    }
+}
+
+void BVH::update() {
+    if(nbObjects != objects.size())
+        build();
+    else
+        refit();
+}
+
+/** Entry distance in a box before tMax */
+static inline bool clip(const BoundingBox &box, const Ray &ray, float tMax, float &tMin) {
+    tMin = 0.f;
+    return ray.clip(box, tMin, tMax);
+}
+
+bool BVH::intersect(const Vec3Df & origin, const Vec3Df & direction, Ray & bestRay) const {
+    if(nodes.empty())
+        return false;
+
+    const Ray worldRay(origin, direction);
+    const float length = direction.getLength();
+    // bestRay starts with its maximum distance when it has no intersection
+    float bestT = sqrt(bestRay.getIntersectionDistance())/length;
+
+    struct ToDo {
+        unsigned node;
+        float tMin;
+    } toDo[MAX_DEPTH];
+    unsigned toDoSize = 0;
+    float tMin;
+
+    if(!clip(nodes[0].bBox, worldRay, bestT, tMin))
+        return bestRay.intersect();
+
+    unsigned node = 0;
+    while(true) {
+        const Node & n = nodes[node];
+        if(n.isLeaf()) {
+            Object *o = objects[n.getObject()];
+            if(o->isEnabled()) {
+                Ray ray = o->getObjectRay(origin, direction, bestRay.getTime());
+                if(o->getKDtree().intersect(ray)) {
+                    ray.setObjectSpace(o, direction);
+                    if(ray.getIntersectionDistance() < bestRay.getIntersectionDistance()) {
+                        bestRay = ray;
+                        bestT = sqrt(ray.getIntersectionDistance())/length;
+                    }
+                }
+            }
+        }
+        else {
+            // Visit the closest son first
+            float tLeft, tRight;
+            bool left = clip(nodes[n.getLeft()].bBox, worldRay, bestT, tLeft);
+            bool right = clip(nodes[n.getRight()].bBox, worldRay, bestT, tRight);
+            if(left && right) {
+                bool leftFirst = tLeft <= tRight;
+                toDo[toDoSize++] = {leftFirst ? n.getRight() : n.getLeft(),
+                                    leftFirst ? tRight : tLeft};
+                node = leftFirst ? n.getLeft() : n.getRight();
+                continue;
+            }
+            if(left || right) {
+                node = left ? n.getLeft() : n.getRight();
+                continue;
+            }
+        }
+
+        // Skip sons entered beyond a closer hit found meanwhile
+        do {
+            if(toDoSize == 0)
+                return bestRay.intersect();
+            toDoSize--;
+        } while(toDo[toDoSize].tMin > bestT);
+        node = toDo[toDoSize].node;
+    }
+}
+
+void BVH::intersect(RayPacket & bestRays) const {
+    if(nodes.empty())
+        return;
+
+    const unsigned SIZE = RayPacket::SIZE;
+    const RayPacket worldRays = bestRays;
+    float lengths[SIZE], bestT[SIZE];
+    for(unsigned i = 0 ; i < SIZE ; i++) {
+        lengths[i] = worldRays[i].getDirection().getLength();
+        bestT[i] = sqrt(bestRays[i].getIntersectionDistance())/lengths[i];
+    }
+
+    // A node is worth it if one of the rays reaches it before its closest hit
+    auto enter = [&](unsigned node, float &tEntry) {
+        bool entered = false;
+        tEntry = numeric_limits<float>::max();
+        for(unsigned i = 0 ; i < SIZE ; i++) {
+            float t;
+            if(clip(nodes[node].bBox, worldRays[i], bestT[i], t)) {
+                entered = true;
+                tEntry = min(tEntry, t);
+            }
+        }
+        return entered;
+    };
+
+    unsigned toDo[MAX_DEPTH];
+    unsigned toDoSize = 0;
+    float tEntry;
+    if(enter(0, tEntry))
+        toDo[toDoSize++] = 0;
+
+    while(toDoSize > 0) {
+        const unsigned node = toDo[--toDoSize];
+        const Node & n = nodes[node];
+        // Closest hits may have moved since it was pushed
+        if(node != 0 && !enter(node, tEntry))
+            continue;
+
+        if(n.isLeaf()) {
+            Object *o = objects[n.getObject()];
+            if(!o->isEnabled())
+                continue;
+            RayPacket rays;
+            for(unsigned i = 0 ; i < SIZE ; i++)
+                rays[i] = o->getObjectRay(worldRays[i].getOrigin(), worldRays[i].getDirection(),
+                                          worldRays[i].getTime());
+            o->getKDtree().intersect(rays);
+            for(unsigned i = 0 ; i < SIZE ; i++) {
+                if(!rays[i].intersect())
+                    continue;
+                rays[i].setObjectSpace(o, worldRays[i].getDirection());
+                if(rays[i].getIntersectionDistance() < bestRays[i].getIntersectionDistance()) {
+                    bestRays[i] = rays[i];
+                    bestT[i] = sqrt(rays[i].getIntersectionDistance())/lengths[i];
+                }
+            }
+        }
+        else {
+            // Closest son on top
+            float tLeft, tRight;
+            bool left = enter(n.getLeft(), tLeft);
+            bool right = enter(n.getRight(), tRight);
+            bool leftFirst = left && (!right || tLeft <= tRight);
+            if(leftFirst) {
+                if(right)
+                    toDo[toDoSize++] = n.getRight();
+                toDo[toDoSize++] = n.getLeft();
+            }
+            else if(right) {
+                if(left)
+                    toDo[toDoSize++] = n.getLeft();
+                toDo[toDoSize++] = n.getRight();
+            }
+        }
+    }
+}
+
+bool BVH::occlude(const Vec3Df & origin, const Vec3Df & direction, float maxT, float time,
+                  bool (*skip)(const Object *)) const {
+    if(nodes.empty())
+        return false;
+
+    const Ray worldRay(origin, direction);
+
+    unsigned toDo[MAX_DEPTH];
+    unsigned toDoSize = 0;
+    float tMin;
+
+    unsigned node = 0;
+    if(clip(nodes[0].bBox, worldRay, maxT, tMin))
+        toDo[toDoSize++] = node;
+
+    while(toDoSize > 0) {
+        const Node & n = nodes[toDo[--toDoSize]];
+        if(n.isLeaf()) {
+            const Object *o = objects[n.getObject()];
+            if(o->isEnabled() && !(skip && skip(o)) &&
+               o->getKDtree().occlude(o->getObjectRay(origin, direction, time), maxT))
+                return true;
+        }
+        else {
+            // Any order is fine, no need to sort sons
+            if(clip(nodes[n.getRight()].bBox, worldRay, maxT, tMin))
+                toDo[toDoSize++] = n.getRight();
+            if(clip(nodes[n.getLeft()].bBox, worldRay, maxT, tMin))
+                toDo[toDoSize++] = n.getLeft();
+        }
+    }
+    return false;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+
+#include "Vec3D.h"
+#include "BoundingBox.h"
+
+class Object;
+class Ray;
+class RayPacket;
+
+/**
+ * Bounding volume hierarchy over the objects of a scene, in world space
+ * Each leaf holds one object, rays only reach the KDtree of objects
+ * whose box they cross
+ * Boxes of mobile objects span their whole motion, rays of any time go through the same hierarchy
+ */
+class BVH {
+public:
+    /** Nodes are stored in an array, sons next to each other */
+    class Node {
+    public:
+        BoundingBox bBox;
+
+        inline bool isLeaf() const { return leaf; }
+        /** Index of the left son, the right one follows */
+        inline unsigned getLeft() const { return index; }
+        inline unsigned getRight() const { return index+1; }
+        /** Index in the scene objects */
+        inline unsigned getObject() const { return index; }
+
+    private:
+        friend class BVH;
+        unsigned index;
+        bool leaf;
+    };
+
+    /** Deepest possible hierarchy, also the traversal stack size */
+    static const unsigned MAX_DEPTH = 64;
+
+    BVH(const std::vector<Object *> &objects);
+
+    /** Build the hierarchy from scratch, needed when objects are added or removed */
+    void build();
+
+    /** Update boxes bottom-up, enough when objects moved or changed shape */
+    void refit();
+
+    /** Build if the number of objects changed, refit otherwise */
+    void update();
+
+    const std::vector<Node> & getNodes() const { return nodes; }
+
+    /**
+     * Closest intersection with an enabled object, at the time of bestRay
+     * bestRay keeps the intersection in the intersected object space, with its world distance
+     */
+    bool intersect(const Vec3Df & origin, const Vec3Df & direction, Ray & bestRay) const;
+
+    /**
+     * Closest intersections of a packet, rays of bestRays give the origins, directions and times
+     * As for single rays, they end in the intersected object space
+     */
+    void intersect(RayPacket & bestRays) const;
+
+    /**
+     * Any hit query, true if an enabled object is hit before origin + maxT*direction
+     * Objects for which skip returns true are ignored
+     */
+    bool occlude(const Vec3Df & origin, const Vec3Df & direction, float maxT, float time = 0.f,
+                 bool (*skip)(const Object *) = nullptr) const;
+
+    /** World space bounding box of an object along its motion */
+    static BoundingBox getBoundingBox(const Object *o);
+
+private:
+    const std::vector<Object *> &objects;
+    std::vector<Node> nodes;
+    unsigned nbObjects;
+
+    /** Fill nodes[node] from the objects in [begin, end) of indices */
+    void build(unsigned node, std::vector<unsigned> &indices,
+               unsigned begin, unsigned end, unsigned depth);
+};
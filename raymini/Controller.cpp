@@ -28,6 +28,9 @@ void Controller::initAll(int argc, char **argv) {
     models.push_back(windowModel);
     renderThread = new RenderThread(this);
     models.push_back(renderThread);
+    progressTimer = new QTimer(this);
+    progressTimer->setInterval(100);
+    connect(progressTimer, SIGNAL(timeout()), this, SLOT(renderProgressed()));
 
     // do this after Scene and RayTracer
     pbgi = new PBGI(this);
@@ -58,6 +61,16 @@ void Controller::initAll(int argc, char **argv) {
 }
 
 void Controller::notifyAll() {
+    // Indirect light cached while rendering belongs to the previous scene
+    const unsigned long lightingChanged = Scene::OBJECT_CHANGED | Scene::LIGHT_CHANGED |
+        Scene::MATERIAL_CHANGED | Scene::COLOR_TEXTURE_CHANGED | Scene::NORMAL_TEXTURE_CHANGED |
+        Scene::BOUNDING_BOX_CHANGED;
+    if (scene->isChanged(lightingChanged) || pbgi->isChanged(PBGI::PBGI_CHANGED) ||
+            rayTracer->isChanged(RayTracer::INDIRECT_CHANGED)) {
+        // Renames do not stop the render, workers must not read what is cleared
+        ensureThreadStopped();
+        rayTracer->clearIndirectLight();
+    }
     for (Observable *m : models) {
         m->notifyAll();
     }
@@ -111,6 +124,7 @@ void Controller::windowSetRayTracerMode(bool b) {
 }
 
 void Controller::threadRenderRayImage() {
+    progressTimer->stop();
     // To avoid dark bands
     if (!renderThread->isEmergencyStop()) {
         windowModel->setRayImage(renderThread->getLastRendered());
@@ -174,8 +188,8 @@ void Controller::windowStopRendering() {
     notifyAll();
 }
 
-void Controller::renderProgressed(float percent) {
-    renderThread->setPercent(percent);
+void Controller::renderProgressed() {
+    renderThread->setPercent(renderThread->getProgressBar().getPercent());
     notifyAll();
 }
 
@@ -186,6 +200,7 @@ void Controller::windowRenderRayImage() {
     viewer->getCameraInformation(fieldOfView, aspectRatio, screenWidth, screenHeight, camPos, viewDirection, upVector, rightVector);
     renderThread->startRendering(camPos, viewDirection, upVector, rightVector,
             fieldOfView, aspectRatio, screenWidth, screenHeight);
+    progressTimer->start();
 }
 
 Vec3Df Controller::userSelectsColor(Vec3Df programColor) {
@@ -400,6 +415,34 @@ void Controller::windowSetNbImagesSpinBox(int i) {
     notifyAll();
 }
 
+void Controller::windowSetPBGIGather(int i) {
+    ensureThreadStopped();
+    pbgi->setGather(i ? PBGI::MICRO_BUFFER : PBGI::RAY_CASTING);
+    renderThread->hasToRedraw();
+    notifyAll();
+}
+
+void Controller::windowSetPBGICutRatio(double r) {
+    ensureThreadStopped();
+    pbgi->setCutRatio(r);
+    renderThread->hasToRedraw();
+    notifyAll();
+}
+
+void Controller::windowSetPhotonMapping(bool b) {
+    ensureThreadStopped();
+    rayTracer->setMode(b ? RayTracer::Mode::PHOTON_MAPPING_MODE : RayTracer::PATH_TRACING_MODE);
+    renderThread->hasToRedraw();
+    notifyAll();
+}
+
+void Controller::windowSetIrradianceCaching(bool b) {
+    ensureThreadStopped();
+    rayTracer->setIrradianceCaching(b);
+    renderThread->hasToRedraw();
+    notifyAll();
+}
+
 void Controller::windowSetOnlyPT(bool b) {
     ensureThreadStopped();
     rayTracer->setOnlyPathTracing(b);
@@ -782,6 +825,7 @@ void Controller::windowSetObjectPos() {
     scene->getObjects()[o]->setTrans(window->getObjectPos());
     scene->setChanged(Scene::OBJECT_CHANGED);
     scene->updateBoundingBox();
+    scene->updateBVH();
     renderThread->hasToRedraw();
     notifyAll();
 }
@@ -795,6 +839,9 @@ void Controller::windowSetObjectMobile() {
     }
     scene->getObjects()[o]->setMobile(window->getObjectMobile());
     scene->setChanged(Scene::OBJECT_CHANGED);
+    // Boxes of the BVH cover the whole motion
+    scene->updateBoundingBox();
+    scene->updateBVH();
     renderThread->hasToRedraw();
     notifyAll();
 }
@@ -878,6 +925,7 @@ void Controller::windowAddObject() {
     m.rotate(Vec3Df(0, 0, 1), M_PI/3.0);
     auto n = new Object(m, scene->getMaterials()[0], "New object");
     scene->getObjects().push_back(n);
+    scene->updateBVH();
     scene->setChanged(Scene::OBJECT_CHANGED);
     windowModel->setSelectedObjectIndex(nb);
     renderThread->hasToRedraw();
@@ -1107,6 +1155,7 @@ void Controller::windowMeshLoadOff() {
         Object *o = scene->getObjects()[io];
         o->getMesh().loadOFF(filename.toStdString().c_str());
         o->updateKDtree();
+        scene->updateBVH();
         scene->setChanged(Scene::OBJECT_CHANGED);
         renderThread->hasToRedraw();
         notifyAll();
@@ -1123,6 +1172,7 @@ void Controller::windowMeshLoadSquare() {
     Object *o = scene->getObjects()[io];
     o->getMesh().loadSquare();
     o->updateKDtree();
+    scene->updateBVH();
     scene->setChanged(Scene::OBJECT_CHANGED);
     renderThread->hasToRedraw();
     notifyAll();
@@ -1140,6 +1190,7 @@ void Controller::windowMeshLoadCube() {
     // Hack: segfault if cube is in glass and in front of a mirror
     o->getMesh().rotate(Vec3Df(0, 0, 1), M_PI/3.0);
     o->updateKDtree();
+    scene->updateBVH();
     scene->setChanged(Scene::OBJECT_CHANGED);
     renderThread->hasToRedraw();
     notifyAll();
@@ -1158,11 +1209,13 @@ void Controller::windowMeshScale() {
     window->getMeshScaleOptions(axis, ratio);
     if (axis == 3) {
         o->getMesh().scale(ratio);
+        o->refitKDtree(KDtree::AxisMap::scale(ratio));
     }
     else {
         o->getMesh().scale(ratio, axis);
+        o->refitKDtree(KDtree::AxisMap::scale(ratio, axis));
     }
-    o->updateKDtree();
+    scene->updateBVH();
     scene->setChanged(Scene::OBJECT_CHANGED);
     renderThread->hasToRedraw();
     notifyAll();
@@ -1180,7 +1233,8 @@ void Controller::windowMeshRotate() {
     float angle = 0;
     window->getMeshRotateOptions(axis, angle);
     o->getMesh().rotate(axis, angle);
-    o->updateKDtree();
+    o->refitKDtree(KDtree::AxisMap::rotation(axis, angle));
+    scene->updateBVH();
     scene->setChanged(Scene::OBJECT_CHANGED);
     renderThread->hasToRedraw();
     notifyAll();
@@ -1193,6 +1247,7 @@ void Controller::viewerStartsDragging(Object *o, Vec3Df i, QPoint p, float r) {
 }
 
 void Controller::viewerMovesWhileDragging(QPoint p) {
+    ensureThreadStopped();
     float fov, ar, screenWidth, screenHeight;
     Vec3Df camPos;
     Vec3Df viewDirection;
@@ -1206,6 +1261,7 @@ void Controller::viewerMovesWhileDragging(QPoint p) {
     float yMove = (float)(lastPos.y()-p.y())/(float)screenHeight/ratio;
     Object *o = windowModel->getDraggedObject();
     o->setTrans(oPos+rightVector*xMove+upVector*yMove);
+    scene->updateBVH();
     scene->setChanged(Scene::OBJECT_CHANGED);
     renderThread->hasToRedraw();
     notifyAll();
@@ -1219,11 +1275,3 @@ void Controller::viewerStopsDragging() {
 void Controller::setRayTracerQuality(RayTracer::Quality quality) {
     rayTracer->setQuality(quality);
 }
-
-void Controller::setSceneMove(int nbPictures) {
-    scene->move(nbPictures);
-}
-
-void Controller::setSceneReset() {
-    scene->reset();
-}
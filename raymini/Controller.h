@@ -6,6 +6,7 @@
 
 #include <QApplication>
 #include <QObject>
+#include <QTimer>
 
 #include "Window.h"
 #include "WindowModel.h"
@@ -67,6 +68,10 @@ public slots :
     void windowSetNbRayPathTracing(int);
     void windowSetIntensityPathTracing(double);
     void windowSetOnlyPT(bool);
+    void windowSetPBGIGather(int);
+    void windowSetPBGICutRatio(double);
+    void windowSetPhotonMapping(bool);
+    void windowSetIrradianceCaching(bool);
     void windowSetNbImagesSpinBox(int);
     void windowSelectLight(int);
     void windowAddLight();
@@ -137,7 +142,8 @@ public slots :
     void threadSetElapsed(int);
     // *****************
 
-    void renderProgressed(float);
+    /** Poll the progress of the render, on a timer */
+    void renderProgressed();
 
     void quitProgram();
 
@@ -155,8 +161,6 @@ public:
 
     // Won't notify ****
     void setRayTracerQuality(RayTracer::Quality quality);
-    void setSceneMove(int nbPictures);
-    void setSceneReset();
     // *****************
 
     /**
@@ -185,6 +189,8 @@ private:
     WindowModel *windowModel;
     PBGI * pbgi;
     RenderThread *renderThread;
+    /** Runs while rendering */
+    QTimer *progressTimer;
 
     // QApplication
     QApplication *raymini;
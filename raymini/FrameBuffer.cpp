@@ -0,0 +1,33 @@
+#include <algorithm>
+
+#include "FrameBuffer.h"
+
+using namespace std;
+
+inline int clamp (float f) {
+    int v = static_cast<int> (255*f);
+    return min(max(v, 0), 255);
+}
+
+void FrameBuffer::resize(unsigned width, unsigned height) {
+    if(width == this->width && height == this->height)
+        return;
+    this->width = width;
+    this->height = height;
+    clear();
+}
+
+void FrameBuffer::clear() {
+    pixels.assign(width*height, Color());
+}
+
+QImage FrameBuffer::toImage(unsigned imageWidth, unsigned imageHeight, unsigned divider) const {
+    QImage image (QSize (imageWidth, imageHeight), QImage::Format_RGB888);
+    for (unsigned int i = 0; i < imageWidth; i++) {
+        for (unsigned int j = 0; j < imageHeight; j++) {
+            const Vec3Df c = get(i/divider, j/divider);
+            image.setPixel(i, j, qRgb(clamp(c[0]), clamp(c[1]), clamp(c[2])));
+        }
+    }
+    return image;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <QImage>
+
+#include "Vec3D.h"
+#include "Color.h"
+
+/**
+ * Pixels a render writes its samples to, owned by whoever renders
+ * Kept over renders of the same view, samples of following ones can be accumulated
+ */
+class FrameBuffer {
+public:
+    FrameBuffer(): width(0), height(0) {}
+
+    unsigned getWidth() const {return width;}
+    unsigned getHeight() const {return height;}
+
+    /** Pixels are kept if the size does not change, lost otherwise */
+    void resize(unsigned width, unsigned height);
+    void clear();
+
+    /** Threads may write different pixels at the same time */
+    void add(unsigned x, unsigned y, const Vec3Df & c) {pixels[y*width + x] += c;}
+    void set(unsigned x, unsigned y, const Vec3Df & c) {pixels[y*width + x] = c;}
+    Vec3Df get(unsigned x, unsigned y) const {return pixels[y*width + x]();}
+
+    /** Picture of imageWidth x imageHeight, each pixel being divider x divider of it */
+    QImage toImage(unsigned imageWidth, unsigned imageHeight, unsigned divider) const;
+
+private:
+    unsigned width;
+    unsigned height;
+    std::vector<Color> pixels;
+};
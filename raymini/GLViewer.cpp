@@ -355,14 +355,22 @@ void GLViewer::init() {
 }
 
 
-void GLViewer::draw_octree(const Octree * t) {
+void GLViewer::draw_octree(const BoundingBox & b) {
     glColor3f(0.f, 0.f, 0.f);
-    drawCube(t->bBox.getMin(), t->bBox.getMax());
+    drawCube(b.getMin(), b.getMax());
 }
 
-bool drawNode(const KDtree *t) {
-    GLViewer::drawCube(t->bBox.getMin(), t->bBox.getMax());
-    return true;
+void drawNode(const BoundingBox &b) {
+    GLViewer::drawCube(b.getMin(), b.getMax());
+}
+
+/** Apply the linear part of an object transform, OpenGL matrices are by columns */
+static void multMatrix(const Matrix &m) {
+    const GLfloat glMatrix[16] = {m[0][0], m[1][0], m[2][0], 0.f,
+                                  m[0][1], m[1][1], m[2][1], 0.f,
+                                  m[0][2], m[1][2], m[2][2], 0.f,
+                                  0.f, 0.f, 0.f, 1.f};
+    glMultMatrixf(glMatrix);
 }
 
 void GLViewer::draw() {
@@ -441,6 +449,7 @@ void GLViewer::draw() {
         const Vec3Df & trans = o->getTrans ();
         glPushMatrix ();
         glTranslatef (trans[0], trans[1], trans[2]);
+        multMatrix(o->getLinear());
         const Material & mat = o->getMaterial ();
         const Vec3Df & color = mat.getColorTexture()->getRepresentativeColor();
         float dif = mat.getDiffuse ();
@@ -472,6 +481,7 @@ void GLViewer::draw() {
             const Vec3Df & trans = o->getTrans ();
             glPushMatrix ();
             glTranslatef (trans[0], trans[1], trans[2]);
+            multMatrix(o->getLinear());
             o->getKDtree().exec(drawNode);
             glPopMatrix ();
         }
@@ -511,7 +521,8 @@ void MiniGLViewer::update(const Observable *o) {
         setSceneCenter(qglviewer::Vec(c[0], c[1], c[2]));
         setSceneRadius(r);
         // Move camera in order to see at least a polygon
-        Vec3Df n = scene->getObjects()[oi]->getMesh().getVertices()[0].getNormal();
+        const Object *o = scene->getObjects()[oi];
+        Vec3Df n = o->getMesh().getVertices()[0].getNormal();
         camera()->setPosition(qglviewer::Vec(n[0], n[1], n[2]));
         camera()->lookAt(qglviewer::Vec(0, 0, 0));
         camera()->fitSphere(camera()->sceneCenter(), camera()->sceneRadius());
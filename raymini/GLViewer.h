@@ -15,6 +15,7 @@
 #include "Observer.h"
 #include "Vertex.h"
 #include "Vec3D.h"
+#include "BoundingBox.h"
 
 class Controller;
 class Octree;
@@ -36,7 +37,8 @@ public:
     };
 
     virtual void update(const Observable *);
-    static void draw_octree(const Octree * t);
+    /** Octree node, for Octree::exec */
+    static void draw_octree(const BoundingBox & b);
     static void drawCube(const Vec3Df min, const Vec3Df max);
 
     void getCameraInformation(float &fov, float &aspectRatio, float &width, float &height, Vec3Df &camPos, Vec3Df &viewDirection, Vec3Df &upVector, Vec3Df &rightVector);
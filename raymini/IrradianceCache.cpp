@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <limits>
+
+#include "IrradianceCache.h"
+
+using namespace std;
+
+IrradianceCache::IrradianceCache(float accuracy):
+    accuracy(accuracy),
+    size(0.f),
+    records(MAX_RECORDS),
+    nodes(MAX_NODES),
+    nbRecords(0),
+    nbNodes(1)
+{
+    nodes[0].first = NONE;
+    nodes[0].sons = 0;
+}
+
+IrradianceCache::~IrradianceCache() {
+}
+
+void IrradianceCache::clear(const BoundingBox & box) {
+    // A little larger, surfaces on the faces of the box stay inside
+    size = 1.01f*box.getSize();
+    origin = box.getCenter() - Vec3Df(size, size, size)/2;
+    nbRecords = 0;
+    nbNodes = 1;
+    nodes[0].first = NONE;
+    nodes[0].sons = 0;
+}
+
+bool IrradianceCache::lookup(const Vec3Df & pos, const Vec3Df & normal, Vec3Df & irradiance) const {
+    irradiance = Vec3Df();
+    float weights = 0.f;
+    lookup(0, origin + Vec3Df(size, size, size)/2, size/2, pos, normal, irradiance, weights);
+    if(weights == 0.f)
+        return false;
+
+    irradiance /= weights;
+    // Gradients extrapolate, they must not make light negative
+    for(unsigned c = 0; c < 3; c++)
+        irradiance[c] = max(irradiance[c], 0.f);
+    return true;
+}
+
+void IrradianceCache::lookup(unsigned node, const Vec3Df & center, float halfSize,
+                             const Vec3Df & pos, const Vec3Df & normal,
+                             Vec3Df & irradiance, float & weights) const {
+    const Node & n = nodes[node];
+    for(unsigned r = n.first.load(memory_order_acquire); r != NONE; r = records[r].next) {
+        const Record & record = records[r];
+        const Vec3Df offset = pos - record.pos;
+        // Points in front of the record see what it does not
+        if(Vec3Df::dotProduct(offset, record.normal + normal) < -0.1f*record.radius)
+            continue;
+        const float error = offset.getLength()/record.radius +
+            sqrt(max(0.f, 1.f - Vec3Df::dotProduct(normal, record.normal)));
+        if(error >= accuracy)
+            continue;
+
+        const float weight = 1.f/max(error, numeric_limits<float>::epsilon());
+        const Vec3Df rotation = Vec3Df::crossProduct(record.normal, normal);
+        for(unsigned c = 0; c < 3; c++)
+            irradiance[c] += weight*(record.irradiance[c] +
+                                     Vec3Df::dotProduct(rotation, record.rotation[c]) +
+                                     Vec3Df::dotProduct(offset, record.translation[c]));
+        weights += weight;
+    }
+
+    const unsigned sons = n.sons.load(memory_order_acquire);
+    if(!sons)
+        return;
+    // Records of a son are valid up to its half size out of it
+    const float quarterSize = halfSize/2;
+    for(unsigned i = 0; i < 8; i++) {
+        Vec3Df sonCenter = center;
+        bool isNear = true;
+        for(unsigned a = 0; a < 3; a++) {
+            sonCenter[a] += (i>>a & 1) ? quarterSize : -quarterSize;
+            isNear = isNear && fabs(pos[a] - sonCenter[a]) <= halfSize;
+        }
+        if(isNear)
+            lookup(sons + i, sonCenter, quarterSize, pos, normal, irradiance, weights);
+    }
+}
+
+void IrradianceCache::insert(const Record & record) {
+    lock_guard<mutex> lock(insertMutex);
+    if(nbRecords == MAX_RECORDS)
+        return;
+
+    // Deepest node the record fits in with its validity radius
+    const float validity = accuracy*record.radius;
+    unsigned node = 0;
+    Vec3Df center = origin + Vec3Df(size, size, size)/2;
+    float halfSize = size/2;
+    bool isInside = true;
+    for(unsigned a = 0; a < 3; a++)
+        isInside = isInside && fabs(record.pos[a] - center[a]) <= halfSize;
+    while(isInside && validity <= halfSize/2) {
+        unsigned sons = nodes[node].sons.load(memory_order_relaxed);
+        if(!sons) {
+            if(nbNodes + 8 > MAX_NODES)
+                break;
+            sons = nbNodes;
+            nbNodes += 8;
+            for(unsigned i = 0; i < 8; i++) {
+                nodes[sons + i].first.store(NONE, memory_order_relaxed);
+                nodes[sons + i].sons.store(0, memory_order_relaxed);
+            }
+            nodes[node].sons.store(sons, memory_order_release);
+        }
+        halfSize /= 2;
+        unsigned i = 0;
+        for(unsigned a = 0; a < 3; a++) {
+            const bool isHigh = record.pos[a] > center[a];
+            i |= isHigh << a;
+            center[a] += isHigh ? halfSize : -halfSize;
+        }
+        node = sons + i;
+    }
+
+    Record & r = records[nbRecords];
+    r = record;
+    r.next = nodes[node].first.load(memory_order_relaxed);
+    nodes[node].first.store(nbRecords, memory_order_release);
+    nbRecords++;
+}
+
+void IrradianceCache::setIrradiance(Record & record, const Vec3Df & u, const Vec3Df & v,
+                                    const float theta[NB_THETA*NB_PHI], const float phi[NB_THETA*NB_PHI],
+                                    const Vec3Df radiances[NB_THETA*NB_PHI],
+                                    const float distances[NB_THETA*NB_PHI]) const {
+    const unsigned nbSamples = NB_THETA*NB_PHI;
+    // Nothing hit is infinitely far
+    auto getDistance = [&](unsigned s) {
+        return distances[s] > 0.f ? distances[s] : numeric_limits<float>::max();
+    };
+
+    record.irradiance = Vec3Df();
+    float inverseDistances = 0.f;
+    for(unsigned c = 0; c < 3; c++)
+        record.rotation[c] = record.translation[c] = Vec3Df();
+    for(unsigned s = 0; s < nbSamples; s++) {
+        record.irradiance += radiances[s];
+        inverseDistances += 1.f/getDistance(s);
+        // Tilting the normal changes the cosine of every sample, normal x tilt is the axis
+        const Vec3Df tilt = tan(theta[s])/nbSamples*(-sin(phi[s])*u + cos(phi[s])*v);
+        for(unsigned c = 0; c < 3; c++)
+            record.rotation[c] += radiances[s][c]*tilt;
+    }
+    record.irradiance /= nbSamples;
+    record.radius = inverseDistances > 0.f ? nbSamples/inverseDistances : MAX_RADIUS*size;
+    record.radius = min(max(record.radius, MIN_RADIUS*size), MAX_RADIUS*size);
+
+    // Ward and Heckbert: moving the record moves the borders of the cells,
+    // by how much depends on the closest of the two sides
+    for(unsigned k = 0; k < NB_PHI; k++) {
+        const float phiCenter = 2*M_PI*(k + 0.5f)/NB_PHI;
+        const float phiBorder = 2*M_PI*k/NB_PHI;
+        const Vec3Df uk = cos(phiCenter)*u + sin(phiCenter)*v;
+        const Vec3Df vk = -sin(phiBorder)*u + cos(phiBorder)*v;
+        for(unsigned j = 0; j < NB_THETA; j++) {
+            const unsigned s = j*NB_PHI + k;
+            const float sinLow = sqrt(float(j)/NB_THETA);
+            const float sinHigh = sqrt(float(j+1)/NB_THETA);
+            Vec3Df gradient[3];
+            if(j > 0) {
+                const unsigned previous = s - NB_PHI;
+                const float cos2 = 1.f - sinLow*sinLow;
+                const float coeff = 2*M_PI/NB_PHI*sinLow*cos2/min(getDistance(s), getDistance(previous));
+                for(unsigned c = 0; c < 3; c++)
+                    gradient[c] += coeff*(radiances[s][c] - radiances[previous][c])*uk;
+            }
+            const unsigned previous = j*NB_PHI + (k + NB_PHI - 1)%NB_PHI;
+            const float coeff = (sinHigh - sinLow)/min(getDistance(s), getDistance(previous));
+            for(unsigned c = 0; c < 3; c++)
+                gradient[c] += coeff*(radiances[s][c] - radiances[previous][c])*vk;
+            // Irradiance here is the cosine-weighted mean, Ward's one over pi
+            for(unsigned c = 0; c < 3; c++)
+                record.translation[c] += gradient[c]/M_PI;
+        }
+    }
+}
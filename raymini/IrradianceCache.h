@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <functional>
+
+#include "Vec3D.h"
+#include "BoundingBox.h"
+
+/**
+ * Indirect diffuse light cached at sparse points of the surfaces, as Ward does
+ * Each record is valid in a radius following the distance of what it sees,
+ * and is moved to nearby points with its rotation and translation gradients
+ *
+ * Records are kept in an octree which lookups read without lock while
+ * a thread inserts, they are never moved once published
+ */
+class IrradianceCache {
+public:
+    /** Gathered directions, stratified on cosine-weighted cells of the hemisphere */
+    static const unsigned NB_THETA = 8;
+    static const unsigned NB_PHI = 24;
+    /** Records are sized to live in fixed arrays, the cache is full afterwards */
+    static const unsigned MAX_RECORDS = 1<<16;
+    static const unsigned MAX_NODES = 1<<16;
+    /** Bounds of the radius of a record, relative to the size of the cache box */
+    static constexpr float MIN_RADIUS = 0.005f;
+    static constexpr float MAX_RADIUS = 0.2f;
+
+    struct Record {
+        Vec3Df pos;
+        Vec3Df normal;
+        Vec3Df irradiance;
+        /** Harmonic mean distance of the gathered surfaces */
+        float radius;
+        /** Gradients of each color channel */
+        Vec3Df rotation[3];
+        Vec3Df translation[3];
+        /** Next record of the same node */
+        unsigned next;
+    };
+
+    /** Largest error allowed, relative to the radius of the records */
+    IrradianceCache(float accuracy = 0.2f);
+    ~IrradianceCache();
+
+    float getAccuracy() const {return accuracy;}
+
+    /** Forget every record, no thread may read meanwhile */
+    void clear(const BoundingBox & box);
+
+    /** Records valid at pos interpolated, false if there is none */
+    bool lookup(const Vec3Df & pos, const Vec3Df & normal, Vec3Df & irradiance) const;
+
+    /** Thread safe, ignored once the cache is full */
+    void insert(const Record & record);
+
+    /**
+     * Record at pos gathered over NB_THETA x NB_PHI directions
+     * radiance(direction, distance) gives the light coming from direction
+     * and sets how far it comes from, 0 if nothing is hit
+     */
+    template <typename Radiance>
+    Record gather(const Vec3Df & pos, const Vec3Df & normal, Radiance radiance) const;
+
+private:
+    static const unsigned NONE = (unsigned)(-1);
+
+    struct Node {
+        /** Head of the record list */
+        std::atomic<unsigned> first;
+        /** First of the 8 sons, 0 for a leaf */
+        std::atomic<unsigned> sons;
+    };
+
+    float accuracy;
+    /** Cube around the box of the scene, records outside stay at the root */
+    Vec3Df origin;
+    float size;
+    std::vector<Record> records;
+    std::vector<Node> nodes;
+    unsigned nbRecords;
+    unsigned nbNodes;
+    /** Render workers are not OpenMP threads */
+    std::mutex insertMutex;
+
+    IrradianceCache(const IrradianceCache &c) = delete;
+    IrradianceCache & operator=(const IrradianceCache &c) = delete;
+
+    /** Add the valid records of node and its sons around pos */
+    void lookup(unsigned node, const Vec3Df & center, float halfSize,
+                const Vec3Df & pos, const Vec3Df & normal,
+                Vec3Df & irradiance, float & weights) const;
+
+    /** Irradiance, radius and gradients of a record from its samples, in the order of gather */
+    void setIrradiance(Record & record, const Vec3Df & u, const Vec3Df & v,
+                       const float theta[NB_THETA*NB_PHI], const float phi[NB_THETA*NB_PHI],
+                       const Vec3Df radiances[NB_THETA*NB_PHI],
+                       const float distances[NB_THETA*NB_PHI]) const;
+};
+
+template <typename Radiance>
+IrradianceCache::Record IrradianceCache::gather(const Vec3Df & pos, const Vec3Df & normal,
+                                                Radiance radiance) const {
+    Record record;
+    record.pos = pos;
+    record.normal = normal;
+
+    Vec3Df u = normal.getOrthogonal();
+    u.normalize();
+    const Vec3Df v = Vec3Df::crossProduct(normal, u);
+
+    // rand() shares its state among all the render threads
+    static thread_local std::minstd_rand jitter(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::uniform_real_distribution<float> uniform;
+
+    float theta[NB_THETA*NB_PHI], phi[NB_THETA*NB_PHI];
+    Vec3Df radiances[NB_THETA*NB_PHI];
+    float distances[NB_THETA*NB_PHI];
+    for(unsigned j = 0; j < NB_THETA; j++) {
+        for(unsigned k = 0; k < NB_PHI; k++) {
+            const unsigned s = j*NB_PHI + k;
+            theta[s] = asin(sqrt((j + uniform(jitter))/NB_THETA));
+            phi[s] = 2*M_PI*(k + uniform(jitter))/NB_PHI;
+            const Vec3Df direction = sin(theta[s])*(cos(phi[s])*u + sin(phi[s])*v) + cos(theta[s])*normal;
+            radiances[s] = radiance(direction, distances[s]);
+        }
+    }
+
+    setIrradiance(record, u, v, theta, phi, radiances, distances);
+    return record;
+}
@@ -1,110 +1,982 @@
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <omp.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "KDtree.h"
-#include "Object.h"
+#include "KDtreeCache.h"
+#include "Shape.h"
+#include "RayPacket.h"
 
 using namespace std;
 
-KDtree::KDtree(Object &o):o(o),
-                                left(nullptr), right(nullptr),
-                                splitAxis(Axis::NONE),
-                                bBox(o.getBoundingBox()) {
-    const Mesh & mesh = o.getMesh();
-    triangles.resize(mesh.getTriangles().size());
+KDtree::KDtree(Shape &shape, Heuristic heuristic):
+    bBox(shape.getBoundingBox()),
+    shape(shape),
+    heuristic(heuristic) {
+    if(KDtreeCache::load(*this))
+        return;
+
+    const Mesh & mesh = shape.getMesh();
+    vector<unsigned> all(mesh.getTriangles().size());
     for(unsigned int i = 0 ; i < mesh.getTriangles().size() ; i++)
-        triangles[i] = i;
-    next();
+        all[i] = i;
+    unsigned maxDepth = getMaxDepth(all.size());
+    unsigned budget = unsigned(MAX_DUPLICATION*all.size());
+
+    Fragment tree;
+    // Tasks go to the threads of an enclosing region, as when a Scene builds its objects
+    if(omp_in_parallel())
+        build(tree, 0, all, bBox, maxDepth, budget);
+    else {
+        #pragma omp parallel
+        #pragma omp single
+        build(tree, 0, all, bBox, maxDepth, budget);
+    }
+    tree.swap(*this);
+    KDtreeCache::save(*this);
+}
+
+unsigned KDtree::getMaxDepth(unsigned nbTriangles) {
+    // Usual kd-tree depth bound
+    return min(8 + unsigned(1.3f*log2(float(nbTriangles+1))), MAX_DEPTH-1);
+}
+
+KDtree::AxisMap KDtree::AxisMap::scale(float s) {
+    // Rounding keeps the order of scaled coordinates, vertices stay on the same side of planes
+    return {{0, 1, 2}, {s, s, s}, true};
+}
+
+KDtree::AxisMap KDtree::AxisMap::scale(float s, unsigned axis) {
+    AxisMap map = scale(1.f);
+    map.factor[axis] = s;
+    return map;
+}
+
+KDtree::AxisMap KDtree::AxisMap::rotation(const Vec3Df &axis, float angle) {
+    Vec3Df normalizedAxis = axis;
+    normalizedAxis.normalize();
+
+    // Rounding of the rotated vertices may move them across planes
+    AxisMap map = scale(1.f);
+    map.isExact = false;
+    AxisMap rotation = map;
+    for(unsigned a = 0 ; a < 3 ; a++) {
+        Vec3Df unit;
+        unit[a] = 1.f;
+        const Vec3Df image = unit.rotate(normalizedAxis, angle);
+        unsigned b = 0;
+        for(unsigned c = 1 ; c < 3 ; c++)
+            if(fabs(image[c]) > fabs(image[b]))
+                b = c;
+        // Planes would not stay axis-aligned, the mesh is on its own
+        if(fabs(image[b]) < 0.999f)
+            return map;
+        rotation.axis[a] = b;
+        rotation.factor[a] = image[b] > 0 ? 1.f : -1.f;
+    }
+    return rotation;
+}
+
+unsigned KDtree::Fragment::addSons() {
+    const unsigned sons = nodes.size();
+    nodes.resize(sons+2);
+    counts.resize(sons+2);
+    return sons;
+}
+
+void KDtree::Fragment::swap(KDtree &tree) {
+    tree.nodes.swap(nodes);
+    tree.triangles.swap(triangles);
+    tree.blocks.swap(blocks);
+    tree.counts.swap(counts);
+}
+
+void KDtree::Fragment::splice(unsigned node, const Fragment &f) {
+    // Nodes of f but its root go at the end
+    const unsigned nodeOffset = nodes.size() - 1;
+    const unsigned triangleOffset = triangles.size();
+    auto relocate = [&](const Node &n) {
+        if(n.isLeaf())
+            return Node::leaf(n.getFirstTriangle() + triangleOffset, n.getNbTriangles());
+        return Node::interior(n.getSplitAxis(), n.getSplit(), n.getLeft() + nodeOffset);
+    };
+
+    nodes[node] = relocate(f.nodes[0]);
+    counts[node] = f.counts[0];
+    for(unsigned i = 1 ; i < f.nodes.size() ; i++)
+        nodes.push_back(relocate(f.nodes[i]));
+    counts.insert(counts.end(), f.counts.begin()+1, f.counts.end());
+    triangles.insert(triangles.end(), f.triangles.begin(), f.triangles.end());
+    blocks.insert(blocks.end(), f.blocks.begin(), f.blocks.end());
 }
 
-void KDtree::next() {
-    if(triangles.size() <= MIN_TRIANGLES) return;//leaf
+void KDtree::build(Fragment &f, unsigned node, const vector<unsigned> &boxTriangles,
+                   const BoundingBox &box, unsigned depthLeft, unsigned budget) const {
+    // Only triangles really crossing the box, their bounding box may not be enough
+    vector<unsigned> nodeTriangles;
+    vector<BoundingBox> bounds;
+    clipTriangles(boxTriangles, box, nodeTriangles, bounds);
+    f.counts[node] = nodeTriangles.size();
 
-    findSplitAxis();
-    float med = bBox.getMiddle(splitAxis);
+    Axis axis;
+    float cut;
+    bool isLeaf;
+    if(heuristic == SAH) {
+        isLeaf = !findSAHSplit(bounds, box, depthLeft, axis, cut);
+    }
+    else {
+        isLeaf = nodeTriangles.size() <= MIN_TRIANGLES || depthLeft == 0;
+        axis = findSplitAxis(box);
+        cut = box.getMiddle(axis);
+    }
+
+    vector<unsigned> lt, rt;
+    if(!isLeaf) {
+        splitTriangles(nodeTriangles, bounds, axis, cut, lt, rt);
+        // Triangles crossing the plane go on both sides, within the budget of the subtree
+        isLeaf = lt.size() + rt.size() > budget;
+    }
+
+    if(isLeaf) {
+        makeLeaf(f, node, nodeTriangles);
+        return;
+    }
+
+    // Sons share what is left of the budget as they share triangles
+    const unsigned leftBudget = (unsigned long long)budget*lt.size()/(lt.size()+rt.size());
+    const unsigned rightBudget = budget - leftBudget;
+    bounds.clear();
+    bounds.shrink_to_fit();
 
     BoundingBox lb, rb;
-    bBox.split(med, splitAxis, lb, rb);
+    box.split(cut, axis, lb, rb);
+
+    unsigned sons = f.addSons();
+    f.nodes[node] = Node::interior(axis, cut, sons);
+
+    if(nodeTriangles.size() < PARALLEL_TRIANGLES) {
+        build(f, sons, lt, lb, depthLeft-1, leftBudget);
+        build(f, sons+1, rt, rb, depthLeft-1, rightBudget);
+        return;
+    }
+
+    // Sons in their own fragments, the left one in another task
+    Fragment left, right;
+    #pragma omp task shared(left, lt, lb)
+    build(left, 0, lt, lb, depthLeft-1, leftBudget);
+    build(right, 0, rt, rb, depthLeft-1, rightBudget);
+    #pragma omp taskwait
+    f.splice(sons, left);
+    f.splice(sons+1, right);
+}
+
+void KDtree::refit(const AxisMap &map) {
+    const BoundingBox oldBox = bBox;
+    bBox = shape.getBoundingBox();
+    // Maybe the mesh went back to a shape already built
+    if(KDtreeCache::load(*this))
+        return;
+
+    // Exact edits do not need triangles to be sent again
+    vector<unsigned> all(map.isExact ? 0 : shape.getMesh().getTriangles().size());
+    for(unsigned int i = 0 ; i < all.size() ; i++)
+        all[i] = i;
+    unsigned maxDepth = getMaxDepth(shape.getMesh().getTriangles().size());
+
+    Fragment tree;
+    if(omp_in_parallel())
+        refit(tree, 0, 0, all, oldBox, bBox, map, maxDepth);
+    else {
+        #pragma omp parallel
+        #pragma omp single
+        refit(tree, 0, 0, all, oldBox, bBox, map, maxDepth);
+    }
+    tree.swap(*this);
+}
+
+void KDtree::refit(Fragment &f, unsigned node, unsigned oldNode, const vector<unsigned> &boxTriangles,
+                   const BoundingBox &oldBox, const BoundingBox &box, const AxisMap &map,
+                   unsigned depthLeft) const {
+    const Node & old = nodes[oldNode];
+    const unsigned oldNbTriangles = counts[oldNode];
+
+    // Exact edits keep triangles in their nodes, the others send them again
+    vector<unsigned> nodeTriangles;
+    vector<BoundingBox> bounds;
+    if(!map.isExact)
+        clipTriangles(boxTriangles, box, nodeTriangles, bounds);
+    else if(old.isLeaf())
+        nodeTriangles.assign(triangles.begin() + old.getFirstTriangle(),
+                             triangles.begin() + old.getFirstTriangle() + old.getNbTriangles());
+    const unsigned nbTriangles = map.isExact ? oldNbTriangles : nodeTriangles.size();
+
+    // Degraded subtrees are built again from scratch
+    auto rebuild = [&]() {
+        if(map.isExact)
+            getTriangles(oldNode, nodeTriangles);
+        build(f, node, nodeTriangles, box, depthLeft, unsigned(MAX_DUPLICATION*nodeTriangles.size()));
+    };
+
+    if(old.isLeaf()) {
+        if(nbTriangles > REFIT_DEGRADATION*oldNbTriangles && nbTriangles > 1) {
+            rebuild();
+            return;
+        }
+        f.counts[node] = oldNbTriangles;
+        makeLeaf(f, node, nodeTriangles);
+        return;
+    }
+
+    const unsigned oldAxis = old.getSplitAxis();
+    const Axis axis = Axis(map.axis[oldAxis]);
+    const float cut = old.getSplit()*map.factor[oldAxis];
+    // Sons swap when the axis is mirrored
+    const bool isMirrored = map.factor[oldAxis] < 0;
+    const unsigned oldLeft = isMirrored ? old.getRight() : old.getLeft();
+    const unsigned oldRight = isMirrored ? old.getLeft() : old.getRight();
+    if(!(cut > box.getMin()[axis] && cut < box.getMax()[axis])) {
+        rebuild();
+        return;
+    }
 
     vector<unsigned> lt, rt;
-    splitTriangles(lb, rb, lt, rt);
+    unsigned nbLeft = counts[oldLeft];
+    unsigned nbRight = counts[oldRight];
+    if(!map.isExact) {
+        splitTriangles(nodeTriangles, bounds, axis, cut, lt, rt);
+        nbLeft = lt.size();
+        nbRight = rt.size();
+    }
+
+    // Cost per triangle of the plane, before and after
+    const float oldCost = getSAHCost(oldBox, oldAxis, old.getSplit(),
+                                     counts[old.getLeft()], counts[old.getRight()])/oldNbTriangles;
+    const float cost = getSAHCost(box, axis, cut, nbLeft, nbRight)/nbTriangles;
+    if(!(cost <= REFIT_DEGRADATION*oldCost)) {
+        rebuild();
+        return;
+    }
+    nodeTriangles.clear();
+    nodeTriangles.shrink_to_fit();
+    bounds.clear();
+    bounds.shrink_to_fit();
+
+    BoundingBox oldLb, oldRb, lb, rb;
+    oldBox.split(old.getSplit(), oldAxis, oldLb, oldRb);
+    box.split(cut, axis, lb, rb);
+    const BoundingBox & oldLeftBox = isMirrored ? oldRb : oldLb;
+    const BoundingBox & oldRightBox = isMirrored ? oldLb : oldRb;
+
+    unsigned sons = f.addSons();
+    f.nodes[node] = Node::interior(axis, cut, sons);
+    f.counts[node] = oldNbTriangles;
+
+    if(nbTriangles < PARALLEL_TRIANGLES) {
+        refit(f, sons, oldLeft, lt, oldLeftBox, lb, map, depthLeft-1);
+        refit(f, sons+1, oldRight, rt, oldRightBox, rb, map, depthLeft-1);
+        return;
+    }
+
+    Fragment left, right;
+    #pragma omp task shared(left, lt, lb, oldLeftBox)
+    refit(left, 0, oldLeft, lt, oldLeftBox, lb, map, depthLeft-1);
+    refit(right, 0, oldRight, rt, oldRightBox, rb, map, depthLeft-1);
+    #pragma omp taskwait
+    f.splice(sons, left);
+    f.splice(sons+1, right);
+}
+
+void KDtree::getTriangles(unsigned node, vector<unsigned> &nodeTriangles) const {
+    nodeTriangles.clear();
+    vector<unsigned> toDo(1, node);
+    while(!toDo.empty()) {
+        const Node & n = nodes[toDo.back()];
+        toDo.pop_back();
+        if(n.isLeaf()) {
+            nodeTriangles.insert(nodeTriangles.end(), triangles.begin() + n.getFirstTriangle(),
+                                 triangles.begin() + n.getFirstTriangle() + n.getNbTriangles());
+        }
+        else {
+            toDo.push_back(n.getLeft());
+            toDo.push_back(n.getRight());
+        }
+    }
+    sort(nodeTriangles.begin(), nodeTriangles.end());
+    nodeTriangles.erase(unique(nodeTriangles.begin(), nodeTriangles.end()), nodeTriangles.end());
+}
+
+void KDtree::makeLeaf(Fragment &f, unsigned node, const vector<unsigned> &nodeTriangles) const {
+    const Mesh & mesh = shape.getMesh();
+    const unsigned SIZE = TriangleBlock::SIZE;
+    f.nodes[node] = Node::leaf(f.triangles.size(), nodeTriangles.size());
+    f.triangles.insert(f.triangles.end(), nodeTriangles.begin(), nodeTriangles.end());
 
-    triangles.clear();//not a leaf
+    for(unsigned first = 0 ; first < nodeTriangles.size() ; first += SIZE) {
+        // Padding has null edges, never hit
+        TriangleBlock block = {};
+        for(unsigned i = 0 ; i < SIZE ; i++) {
+            block.index[i] = -1;
+            if(first+i >= nodeTriangles.size())
+                continue;
+            const unsigned t = nodeTriangles[first+i];
+            const Triangle & triangle = mesh.getTriangles()[t];
+            const Vec3Df & p0 = mesh.getVertices()[triangle.getVertex(0)].getPos();
+            const Vec3Df & p1 = mesh.getVertices()[triangle.getVertex(1)].getPos();
+            const Vec3Df & p2 = mesh.getVertices()[triangle.getVertex(2)].getPos();
+            for(unsigned a = 0 ; a < 3 ; a++) {
+                block.base[a][i] = p2[a];
+                block.edgeU[a][i] = p0[a] - p2[a];
+                block.edgeV[a][i] = p1[a] - p2[a];
+            }
+            block.index[i] = t;
+        }
+        f.blocks.push_back(block);
+    }
+    // Next leaf starts on a new block
+    f.triangles.resize(f.blocks.size()*SIZE, nodeTriangles.empty() ? 0 : nodeTriangles.back());
+}
 
-    left = new KDtree(o, lt, lb);
-    right = new KDtree(o, rt, rb);
+void KDtree::exec(unsigned node, const BoundingBox &box, void (*f)(const BoundingBox &)) const {
+    f(box);
+    const Node &n = nodes[node];
+    if(!n.isLeaf()) {
+        BoundingBox lb, rb;
+        box.split(n.getSplit(), n.getSplitAxis(), lb, rb);
+        exec(n.getLeft(), lb, f);
+        exec(n.getRight(), rb, f);
+    }
 }
 
-void KDtree::findSplitAxis() {
-    Vec3Df delta = bBox.getMax()-bBox.getMin();
+Axis KDtree::findSplitAxis(const BoundingBox &box) const {
+    Vec3Df delta = box.getMax()-box.getMin();
 
     if(delta[0] <= delta[1]) {
         if(delta[1] <= delta[2])
-            splitAxis = Axis::Z;
+            return Axis::Z;
         else
-            splitAxis = Axis::Y;
+            return Axis::Y;
     }
     else {
         if(delta[0] <= delta[2])
-            splitAxis = Axis::Z;
+            return Axis::Z;
         else
-            splitAxis = Axis::X;
+            return Axis::X;
+    }
+}
+
+template <typename Side>
+void KDtree::partition(const vector<unsigned> &nodeTriangles, Side side,
+                       vector<unsigned> &left, vector<unsigned> &right) {
+    const unsigned nbChunks = max(1u, unsigned(nodeTriangles.size()/PARALLEL_TRIANGLES));
+    vector<vector<unsigned>> lefts(nbChunks), rights(nbChunks);
+
+    // A taskgroup waits for the chunks only, not for a sibling subtree being built
+    #pragma omp taskgroup
+    for(unsigned chunk = 0 ; chunk < nbChunks ; chunk++) {
+        #pragma omp task shared(nodeTriangles, side, lefts, rights) if(nbChunks > 1)
+        {
+            const unsigned begin = nodeTriangles.size()*chunk/nbChunks;
+            const unsigned end = nodeTriangles.size()*(chunk+1)/nbChunks;
+            for(unsigned i = begin ; i < end ; i++) {
+                bool isInLeft, isInRight;
+                side(i, isInLeft, isInRight);
+                if(isInLeft)
+                    lefts[chunk].push_back(nodeTriangles[i]);
+                if(isInRight)
+                    rights[chunk].push_back(nodeTriangles[i]);
+            }
+        }
+    }
+
+    if(nbChunks == 1) {
+        left.swap(lefts[0]);
+        right.swap(rights[0]);
+        return;
+    }
+    for(unsigned chunk = 0 ; chunk < nbChunks ; chunk++) {
+        left.insert(left.end(), lefts[chunk].begin(), lefts[chunk].end());
+        right.insert(right.end(), rights[chunk].begin(), rights[chunk].end());
+    }
+}
+
+bool KDtree::clipTriangle(unsigned t, const BoundingBox &box, BoundingBox &bounds) const {
+    const Mesh & mesh = shape.getMesh();
+    const Triangle & triangle = mesh.getTriangles()[t];
+    // Each plane adds at most one vertex
+    Vec3Df polygon[9], clipped[9];
+    unsigned size = 3;
+    for(unsigned i = 0 ; i<3 ; i++)
+        polygon[i] = mesh.getVertices()[triangle.getVertex(i)].getPos();
+
+    bounds = BoundingBox(polygon[0]);
+    bounds.extendTo(polygon[1]);
+    bounds.extendTo(polygon[2]);
+    bool isInside = true;
+    for(unsigned axis = 0 ; axis < 3 ; axis++) {
+        if(bounds.getMax()[axis] < box.getMin()[axis] || bounds.getMin()[axis] > box.getMax()[axis])
+            return false;
+        isInside = isInside && bounds.getMin()[axis] >= box.getMin()[axis] &&
+            bounds.getMax()[axis] <= box.getMax()[axis];
+    }
+    if(isInside)
+        return true;
+
+    // Sutherland-Hodgman against the six planes of the box
+    for(unsigned plane = 0 ; plane < 6 ; plane++) {
+        const unsigned axis = plane/2;
+        const bool isMax = plane%2;
+        const float limit = isMax ? box.getMax()[axis] : box.getMin()[axis];
+        auto in = [&](const Vec3Df &p) {
+            return isMax ? p[axis] <= limit : p[axis] >= limit;
+        };
+
+        unsigned nbClipped = 0;
+        for(unsigned i = 0 ; i < size ; i++) {
+            const Vec3Df & a = polygon[i];
+            const Vec3Df & b = polygon[(i+1)%size];
+            if(in(a))
+                clipped[nbClipped++] = a;
+            if(in(a) != in(b)) {
+                Vec3Df p = a + (b-a)*((limit-a[axis])/(b[axis]-a[axis]));
+                p[axis] = limit;
+                clipped[nbClipped++] = p;
+            }
+        }
+        if(nbClipped == 0)
+            return false;
+        size = nbClipped;
+        copy(clipped, clipped+size, polygon);
+    }
+
+    bounds = BoundingBox(polygon[0]);
+    for(unsigned i = 1 ; i < size ; i++)
+        bounds.extendTo(polygon[i]);
+    // Rounding of the intersections must not leave the box
+    Vec3Df min, max;
+    for(unsigned axis = 0 ; axis < 3 ; axis++) {
+        min[axis] = std::max(bounds.getMin()[axis], box.getMin()[axis]);
+        max[axis] = std::min(bounds.getMax()[axis], box.getMax()[axis]);
+    }
+    bounds = BoundingBox(min, max);
+    return true;
+}
+
+void KDtree::clipTriangles(const vector<unsigned> &boxTriangles, const BoundingBox &box,
+                           vector<unsigned> &nodeTriangles, vector<BoundingBox> &bounds) const {
+    vector<BoundingBox> allBounds(boxTriangles.size());
+    vector<char> isIn(boxTriangles.size());
+    const unsigned nbChunks = max(1u, unsigned(boxTriangles.size()/PARALLEL_TRIANGLES));
+
+    #pragma omp taskgroup
+    for(unsigned chunk = 0 ; chunk < nbChunks ; chunk++) {
+        #pragma omp task shared(boxTriangles, box, allBounds, isIn) if(nbChunks > 1)
+        {
+            const unsigned begin = boxTriangles.size()*chunk/nbChunks;
+            const unsigned end = boxTriangles.size()*(chunk+1)/nbChunks;
+            for(unsigned i = begin ; i < end ; i++)
+                isIn[i] = clipTriangle(boxTriangles[i], box, allBounds[i]);
+        }
+    }
+
+    nodeTriangles.reserve(boxTriangles.size());
+    bounds.reserve(boxTriangles.size());
+    for(unsigned i = 0 ; i < boxTriangles.size() ; i++) {
+        if(isIn[i]) {
+            nodeTriangles.push_back(boxTriangles[i]);
+            bounds.push_back(allBounds[i]);
+        }
+    }
+}
+
+bool KDtree::findSAHSplit(const vector<BoundingBox> &bounds, const BoundingBox &box,
+                          unsigned depthLeft, Axis &bestAxis, float &cut) const {
+    if(bounds.size() <= 1 || depthLeft == 0) return false;
+
+    const float leafCost = SAH_INTERSECTION_COST*bounds.size();
+    float costs[3] = {leafCost, leafCost, leafCost};
+    float cuts[3];
+
+    // One task per axis on large nodes
+    #pragma omp taskgroup
+    for(unsigned axis = 0 ; axis < 3 ; axis++) {
+        #pragma omp task shared(bounds, box, costs, cuts) if(bounds.size() >= PARALLEL_TRIANGLES)
+        findSAHSplit(bounds, box, axis, costs[axis], cuts[axis]);
+    }
+
+    float bestCost = leafCost;
+    bestAxis = Axis::NONE;
+    for(unsigned axis = 0 ; axis < 3 ; axis++) {
+        if(costs[axis] < bestCost) {
+            bestCost = costs[axis];
+            bestAxis = Axis(axis);
+            cut = cuts[axis];
+        }
+    }
+    return bestAxis != Axis::NONE;
+}
+
+float KDtree::getSAHCost(const BoundingBox &box, unsigned axis, float cut,
+                         unsigned nbLeft, unsigned nbRight) {
+    auto area = [](const Vec3Df &d) {
+        return 2.f*(d[0]*d[1] + d[1]*d[2] + d[2]*d[0]);
+    };
+    const Vec3Df delta = box.getMax()-box.getMin();
+    Vec3Df leftDelta = delta, rightDelta = delta;
+    leftDelta[axis] = cut - box.getMin()[axis];
+    rightDelta[axis] = box.getMax()[axis] - cut;
+
+    float bonus = (nbLeft == 0 || nbRight == 0) ? SAH_EMPTY_BONUS : 0.f;
+    return SAH_TRAVERSAL_COST + (1.f-bonus)*SAH_INTERSECTION_COST/area(delta)*
+        (area(leftDelta)*nbLeft + area(rightDelta)*nbRight);
+}
+
+void KDtree::findSAHSplit(const vector<BoundingBox> &bounds, const BoundingBox &box,
+                          unsigned axis, float &cost, float &cut) const {
+    const Vec3Df delta = box.getMax()-box.getMin();
+    const float invArea = 1.f/(delta[0]*delta[1] + delta[1]*delta[2] + delta[2]*delta[0]);
+    if(delta[axis] <= 0 || !std::isfinite(invArea)) return;
+
+    // Count where triangles start and end along the axis
+    unsigned starts[SAH_BINS] = {0};
+    unsigned ends[SAH_BINS] = {0};
+    const float min = box.getMin()[axis];
+    const float binsOverDelta = SAH_BINS/delta[axis];
+    auto bin = [&](float p) {
+        int b = int((p-min)*binsOverDelta);
+        return unsigned(std::min(std::max(b, 0), int(SAH_BINS)-1));
+    };
+    for(const BoundingBox & b : bounds) {
+        starts[bin(b.getMin()[axis])]++;
+        ends[bin(b.getMax()[axis])]++;
     }
+
+    // Sweep the planes between bins
+    unsigned nbLeft = 0;
+    unsigned nbRight = bounds.size();
+    for(unsigned i = 1 ; i < SAH_BINS ; i++) {
+        nbLeft += starts[i-1];
+        nbRight -= ends[i-1];
+
+        float plane = min + i*delta[axis]/SAH_BINS;
+        float planeCost = getSAHCost(box, axis, plane, nbLeft, nbRight);
+
+        if(planeCost < cost) {
+            cost = planeCost;
+            cut = plane;
+        }
+    }
+}
+
+void KDtree::splitTriangles(const vector<unsigned> &nodeTriangles,
+                            const vector<BoundingBox> &bounds, Axis axis, float cut,
+                            vector<unsigned> &left, vector<unsigned> &right) {
+    // Clipped parts are convex, crossing the plane means reaching both sons
+    auto side = [&](unsigned i, bool &isInLeft, bool &isInRight) {
+        isInLeft = bounds[i].getMin()[axis] <= cut;
+        isInRight = bounds[i].getMax()[axis] > cut;
+    };
+    partition(nodeTriangles, side, left, right);
+}
+
+#ifdef __SSE2__
+static inline __m128 dot(const __m128 a[3], const __m128 b[3]) {
+    return _mm_add_ps(_mm_mul_ps(a[0], b[0]),
+           _mm_add_ps(_mm_mul_ps(a[1], b[1]), _mm_mul_ps(a[2], b[2])));
+}
+
+static inline void cross(const __m128 a[3], const __m128 b[3], __m128 c[3]) {
+    for(unsigned i = 0 ; i < 3 ; i++) {
+        unsigned j = (i+1)%3, k = (i+2)%3;
+        c[i] = _mm_sub_ps(_mm_mul_ps(a[j], b[k]), _mm_mul_ps(a[k], b[j]));
+    }
+}
+
+static inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/**
+ * Moller-Trumbore acceptance, with the culling of Ray::intersect
+ * Null determinants give infinite or NaN coordinates, rejected
+ */
+static inline __m128 isHit(__m128 det, __m128 u, __m128 v, __m128 t) {
+    const __m128 zero = _mm_setzero_ps();
+    __m128 hit = _mm_and_ps(_mm_cmpge_ps(det, zero), _mm_cmpge_ps(t, zero));
+    hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+    return _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
 }
+#endif
 
-void KDtree::splitTriangles(const BoundingBox & lb, const BoundingBox & rb,
-                            std::vector<unsigned> &left, std::vector<unsigned> &right) const {
-    const Mesh & mesh = o.getMesh();
-    for(unsigned t : triangles) {
-        bool isInLeft = false;
-        bool isInRight = false;
+int KDtree::intersectLeaf(const Node &n, const Vec3Df &origin, const Vec3Df &direction,
+                          float &distance) const {
+    const unsigned SIZE = TriangleBlock::SIZE;
+    const unsigned first = n.getFirstTriangle()/SIZE;
+    const unsigned end = first + (n.getNbTriangles()+SIZE-1)/SIZE;
+    const float squaredLength = direction.getSquaredLength();
+    int closest = -1;
 
-        for(unsigned i = 0 ; i<3 ; i++) {
-            unsigned v = mesh.getTriangles()[t].getVertex(i);
-            const Vec3Df & p = mesh.getVertices()[v].getPos();
-            if(lb.contains(p))
-                isInLeft = true;
-            else if(rb.contains(p))
-                isInRight = true;
+#ifdef __SSE2__
+    static_assert(TriangleBlock::SIZE == 4, "A block fills a SSE register");
+    __m128 o[3], d[3];
+    for(unsigned a = 0 ; a < 3 ; a++) {
+        o[a] = _mm_set1_ps(origin[a]);
+        d[a] = _mm_set1_ps(direction[a]);
+    }
+    __m128 bestDistance = _mm_set1_ps(distance);
+    __m128i bestTriangle = _mm_set1_epi32(-1);
+
+    // Moller-Trumbore, one ray against every triangle of a block
+    for(unsigned b = first ; b < end ; b++) {
+        const TriangleBlock & block = blocks[b];
+        __m128 edgeU[3], edgeV[3], tvec[3];
+        for(unsigned a = 0 ; a < 3 ; a++) {
+            edgeU[a] = _mm_loadu_ps(block.edgeU[a]);
+            edgeV[a] = _mm_loadu_ps(block.edgeV[a]);
+            tvec[a] = _mm_sub_ps(o[a], _mm_loadu_ps(block.base[a]));
         }
+        __m128 pvec[3], qvec[3];
+        cross(d, edgeV, pvec);
+        cross(tvec, edgeU, qvec);
+        const __m128 det = dot(edgeU, pvec);
+        const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+        const __m128 u = _mm_mul_ps(dot(tvec, pvec), invDet);
+        const __m128 v = _mm_mul_ps(dot(d, qvec), invDet);
+        const __m128 t = _mm_mul_ps(dot(edgeV, qvec), invDet);
+        const __m128 squaredDistance = _mm_mul_ps(_mm_mul_ps(t, t), _mm_set1_ps(squaredLength));
+
+        __m128 hit = _mm_and_ps(isHit(det, u, v, t), _mm_cmplt_ps(squaredDistance, bestDistance));
+        if(!_mm_movemask_ps(hit))
+            continue;
+        bestDistance = select(hit, squaredDistance, bestDistance);
+        const __m128i hitInt = _mm_castps_si128(hit);
+        bestTriangle = _mm_or_si128(_mm_and_si128(hitInt, _mm_loadu_si128((const __m128i *)block.index)),
+                                    _mm_andnot_si128(hitInt, bestTriangle));
+    }
 
-        if(isInLeft)
-            left.push_back(t);
-        if(isInRight)
-            right.push_back(t);
+    // Closest of the lanes
+    float distances[SIZE];
+    int indices[SIZE];
+    _mm_storeu_ps(distances, bestDistance);
+    _mm_storeu_si128((__m128i *)indices, bestTriangle);
+    for(unsigned l = 0 ; l < SIZE ; l++) {
+        if(indices[l] >= 0 && distances[l] < distance) {
+            distance = distances[l];
+            closest = indices[l];
+        }
     }
+#else
+    for(unsigned b = first ; b < end ; b++) {
+        const TriangleBlock & block = blocks[b];
+        for(unsigned l = 0 ; l < SIZE && block.index[l] >= 0 ; l++) {
+            const Vec3Df edgeU(block.edgeU[0][l], block.edgeU[1][l], block.edgeU[2][l]);
+            const Vec3Df edgeV(block.edgeV[0][l], block.edgeV[1][l], block.edgeV[2][l]);
+            const Vec3Df tvec = origin - Vec3Df(block.base[0][l], block.base[1][l], block.base[2][l]);
+            const Vec3Df pvec = Vec3Df::crossProduct(direction, edgeV);
+            const Vec3Df qvec = Vec3Df::crossProduct(tvec, edgeU);
+            const float det = Vec3Df::dotProduct(edgeU, pvec);
+            if(det <= 0)
+                continue;
+            const float u = Vec3Df::dotProduct(tvec, pvec)/det;
+            const float v = Vec3Df::dotProduct(direction, qvec)/det;
+            const float t = Vec3Df::dotProduct(edgeV, qvec)/det;
+            if(u < 0 || v < 0 || u+v > 1 || t < 0 || t*t*squaredLength >= distance)
+                continue;
+            distance = t*t*squaredLength;
+            closest = block.index[l];
+        }
+    }
+#endif
+    return closest;
+}
+
+bool KDtree::setIntersection(Ray &ray, int triangle) const {
+    const Mesh & mesh = shape.getMesh();
+    const Triangle & t = mesh.getTriangles()[triangle];
+    const Vertex & v0 = mesh.getVertices() [t.getVertex(0)];
+    const Vertex & v1 = mesh.getVertices() [t.getVertex(1)];
+    const Vertex & v2 = mesh.getVertices() [t.getVertex(2)];
+    return ray.intersect(t, v0, v1, v2, nullptr);
 }
 
 bool KDtree::intersect(Ray &ray) const {
-    const Mesh & mesh = o.getMesh();
+    const Vec3Df & origin = ray.getOrigin();
+    const Vec3Df & direction = ray.getDirection();
+    const Vec3Df & invDirection = ray.getInvDirection();
+
+    float tMin, tMax;
+    if(!ray.intersect(bBox, tMin, tMax))
+        return false;
+
+    // Ray parameter of the closest hit so far
+    const float squaredLength = direction.getSquaredLength();
+    auto hitT = [&]() {
+        return sqrt(ray.getIntersectionDistance()/squaredLength);
+    };
+    float bestT = ray.intersect() ? hitT() : numeric_limits<float>::max();
+    if(tMin > bestT)
+        return true;
 
-    if(splitAxis ==  Axis::NONE) {
-        for(unsigned idT : triangles) {
-            const Triangle & t = mesh.getTriangles()[idT];
-            const Vertex & v0 = mesh.getVertices() [t.getVertex(0)];
-            const Vertex & v1 = mesh.getVertices() [t.getVertex(1)];
-            const Vertex & v2 = mesh.getVertices() [t.getVertex(2)];
+    struct ToDo {
+        unsigned node;
+        float tMin, tMax;
+    } toDo[MAX_DEPTH];
+    unsigned toDoSize = 0;
 
-            ray.intersect(t, v0, v1, v2, &o);
+    unsigned node = 0;
+    while(true) {
+        const Node & n = nodes[node];
+        if(!n.isLeaf()) {
+            // Sons in front to back order
+            const Axis axis = n.getSplitAxis();
+            const float tPlane = (n.getSplit() - origin[axis]) * invDirection[axis];
+            const bool leftFirst = origin[axis] < n.getSplit() ||
+                (origin[axis] == n.getSplit() && direction[axis] <= 0);
+            const unsigned first = leftFirst ? n.getLeft() : n.getRight();
+            const unsigned second = leftFirst ? n.getRight() : n.getLeft();
+
+            if(tPlane > tMax || tPlane <= 0)
+                node = first;
+            else if(tPlane < tMin)
+                node = second;
+            else {
+                // Far son is useless if already beyond the closest hit
+                if(tPlane <= bestT)
+                    toDo[toDoSize++] = {second, tPlane, tMax};
+                node = first;
+                tMax = tPlane;
+            }
+            continue;
         }
-        return ray.intersect();
+
+        float distance = ray.intersect() ? ray.getIntersectionDistance() : numeric_limits<float>::max();
+        int closest = intersectLeaf(n, origin, direction, distance);
+        if(closest >= 0 && setIntersection(ray, closest))
+            bestT = hitT();
+
+        // A triangle straddling the leaf might be hit beyond it,
+        // the closest hit is only known once it is inside the leaf
+        if(ray.intersect() && bestT <= tMax)
+            return true;
+
+        do {
+            if(toDoSize == 0)
+                return ray.intersect();
+            toDoSize--;
+            node = toDo[toDoSize].node;
+            tMin = toDo[toDoSize].tMin;
+            tMax = toDo[toDoSize].tMax;
+        } while(tMin > bestT);
     }
-    else {
-        Vec3Df lI, rI;
-        bool leftIntersection = ray.intersect(left->bBox, lI);
-        bool rightIntersection = ray.intersect(right->bBox, rI);
+}
+
+void KDtree::intersect(RayPacket &packet) const {
+#ifdef __SSE2__
+    if(packet.isCoherent()) {
+        intersectPacket(packet);
+        return;
+    }
+#endif
+    // Diverging rays visit different nodes, trace them one by one
+    for(unsigned i = 0 ; i < RayPacket::SIZE ; i++)
+        intersect(packet[i]);
+}
+
+#ifdef __SSE2__
+void KDtree::intersectPacket(RayPacket &packet) const {
+    static_assert(RayPacket::SIZE == 4, "A packet fills a SSE register");
+    const float infinity = numeric_limits<float>::infinity();
 
-        if(leftIntersection && rightIntersection) {
-            KDtree * far;
-            KDtree * near;
+    // One lane per ray
+    __m128 origin[3], direction[3], invDirection[3];
+    for(unsigned a = 0 ; a < 3 ; a++) {
+        origin[a] = _mm_setr_ps(packet[0].getOrigin()[a], packet[1].getOrigin()[a],
+                                packet[2].getOrigin()[a], packet[3].getOrigin()[a]);
+        direction[a] = _mm_setr_ps(packet[0].getDirection()[a], packet[1].getDirection()[a],
+                                   packet[2].getDirection()[a], packet[3].getDirection()[a]);
+        invDirection[a] = _mm_setr_ps(packet[0].getInvDirection()[a], packet[1].getInvDirection()[a],
+                                      packet[2].getInvDirection()[a], packet[3].getInvDirection()[a]);
+    }
+    const __m128 squaredLength = _mm_add_ps(_mm_mul_ps(direction[0], direction[0]),
+                                 _mm_add_ps(_mm_mul_ps(direction[1], direction[1]),
+                                            _mm_mul_ps(direction[2], direction[2])));
+
+    __m128 tMin = _mm_setzero_ps();
+    __m128 tMax = _mm_set1_ps(infinity);
+    for(unsigned a = 0 ; a < 3 ; a++) {
+        __m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bBox.getMin()[a]), origin[a]), invDirection[a]);
+        __m128 tFar = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bBox.getMax()[a]), origin[a]), invDirection[a]);
+        // NaN, when parallel on a slab side, does not clip: SSE min and max return their second operand
+        tMin = _mm_max_ps(_mm_min_ps(tNear, tFar), tMin);
+        tMax = _mm_min_ps(_mm_max_ps(tNear, tFar), tMax);
+    }
+
+    // Squared distance and triangle of the closest hit so far
+    __m128 bestDistance = _mm_setr_ps(
+        packet[0].intersect() ? packet[0].getIntersectionDistance() : infinity,
+        packet[1].intersect() ? packet[1].getIntersectionDistance() : infinity,
+        packet[2].intersect() ? packet[2].getIntersectionDistance() : infinity,
+        packet[3].intersect() ? packet[3].getIntersectionDistance() : infinity);
+    __m128 bestT = _mm_sqrt_ps(_mm_div_ps(bestDistance, squaredLength));
+    __m128i bestTriangle = _mm_set1_epi32(-1);
+    // Lanes whose closest hit is known
+    __m128 done = _mm_setzero_ps();
+
+    __m128 mask = _mm_and_ps(_mm_cmple_ps(tMin, tMax), _mm_cmple_ps(tMin, bestT));
+
+    struct ToDo {
+        unsigned node;
+        __m128 tMin, tMax, mask;
+    } toDo[MAX_DEPTH];
+    unsigned toDoSize = 0;
 
-            float iDistanceL = Vec3Df::squaredDistance (lI, ray.getOrigin());
-            float iDistanceR = Vec3Df::squaredDistance (rI, ray.getOrigin());
+    unsigned node = 0;
+    while(_mm_movemask_ps(mask)) {
+        const Node & n = nodes[node];
+        if(!n.isLeaf()) {
+            // Same direction signs, the near son is the same for every lane
+            const Axis axis = n.getSplitAxis();
+            const __m128 tPlane = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.getSplit()), origin[axis]),
+                                             invDirection[axis]);
+            const bool leftFirst = !packet[0].isNegative(axis);
+            const unsigned first = leftFirst ? n.getLeft() : n.getRight();
+            const unsigned second = leftFirst ? n.getRight() : n.getLeft();
 
-            far = (iDistanceR > iDistanceL) ? right : left;
-            near = (iDistanceR > iDistanceL) ? left : right;
+            // NaN, starting on the plane parallel to it, goes to both sons
+            const __m128 firstMask = _mm_and_ps(mask, _mm_cmpnlt_ps(tPlane, tMin));
+            const __m128 secondMask = _mm_and_ps(mask, _mm_cmpngt_ps(tPlane, _mm_min_ps(tMax, bestT)));
+            const bool goFirst = _mm_movemask_ps(firstMask);
+            const bool goSecond = _mm_movemask_ps(secondMask);
 
-            return near->intersect(ray) || far->intersect(ray);
+            if(goFirst) {
+                if(goSecond)
+                    toDo[toDoSize++] = {second, _mm_max_ps(tPlane, tMin), tMax, secondMask};
+                node = first;
+                mask = firstMask;
+                tMax = _mm_min_ps(tPlane, tMax);
+                continue;
+            }
+            if(goSecond) {
+                node = second;
+                mask = secondMask;
+                tMin = _mm_max_ps(tPlane, tMin);
+                continue;
+            }
         }
+        else {
+            const unsigned first = n.getFirstTriangle()/TriangleBlock::SIZE;
+            const unsigned end = first + (n.getNbTriangles()+TriangleBlock::SIZE-1)/TriangleBlock::SIZE;
+            for(unsigned b = first ; b < end ; b++) {
+                const TriangleBlock & block = blocks[b];
+                for(unsigned l = 0 ; l < TriangleBlock::SIZE && block.index[l] >= 0 ; l++) {
+                    // Moller-Trumbore, one triangle against every lane
+                    __m128 edgeU[3], edgeV[3], tvec[3];
+                    for(unsigned a = 0 ; a < 3 ; a++) {
+                        edgeU[a] = _mm_set1_ps(block.edgeU[a][l]);
+                        edgeV[a] = _mm_set1_ps(block.edgeV[a][l]);
+                        tvec[a] = _mm_sub_ps(origin[a], _mm_set1_ps(block.base[a][l]));
+                    }
+                    __m128 pvec[3], qvec[3];
+                    cross(direction, edgeV, pvec);
+                    cross(tvec, edgeU, qvec);
+                    const __m128 det = dot(edgeU, pvec);
+                    const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+                    const __m128 u = _mm_mul_ps(dot(tvec, pvec), invDet);
+                    const __m128 v = _mm_mul_ps(dot(direction, qvec), invDet);
+                    const __m128 t = _mm_mul_ps(dot(edgeV, qvec), invDet);
+                    const __m128 distance = _mm_mul_ps(_mm_mul_ps(t, t), squaredLength);
 
-        return (leftIntersection && left->intersect(ray)) || (rightIntersection && right->intersect(ray));
+                    __m128 hit = _mm_and_ps(mask, isHit(det, u, v, t));
+                    hit = _mm_and_ps(hit, _mm_cmplt_ps(distance, bestDistance));
+                    if(!_mm_movemask_ps(hit))
+                        continue;
+                    bestDistance = select(hit, distance, bestDistance);
+                    const __m128i hitInt = _mm_castps_si128(hit);
+                    bestTriangle = _mm_or_si128(_mm_and_si128(hitInt, _mm_set1_epi32(block.index[l])),
+                                                _mm_andnot_si128(hitInt, bestTriangle));
+                }
+            }
+            bestT = _mm_sqrt_ps(_mm_div_ps(bestDistance, squaredLength));
+
+            // As for single rays, a hit is the closest once inside the leaf
+            const __m128 found = _mm_and_ps(_mm_cmplt_ps(bestDistance, _mm_set1_ps(infinity)),
+                                            _mm_cmple_ps(bestT, tMax));
+            done = _mm_or_ps(done, _mm_and_ps(mask, found));
+        }
+
+        mask = _mm_setzero_ps();
+        while(toDoSize > 0 && !_mm_movemask_ps(mask)) {
+            toDoSize--;
+            node = toDo[toDoSize].node;
+            tMin = toDo[toDoSize].tMin;
+            tMax = toDo[toDoSize].tMax;
+            mask = _mm_andnot_ps(done, _mm_and_ps(toDo[toDoSize].mask, _mm_cmple_ps(tMin, bestT)));
+        }
     }
+
+    // Fill the rays with their closest triangle
+    int closest[RayPacket::SIZE];
+    _mm_storeu_si128((__m128i *)closest, bestTriangle);
+    for(unsigned i = 0 ; i < RayPacket::SIZE ; i++)
+        if(closest[i] >= 0)
+            setIntersection(packet[i], closest[i]);
 }
+#endif
 
+bool KDtree::occlude(const Ray &ray, float maxT) const {
+    const Vec3Df & origin = ray.getOrigin();
+    const Vec3Df & direction = ray.getDirection();
+    const Vec3Df & invDirection = ray.getInvDirection();
+
+    float tMin = 0.f, tMax = maxT;
+    if(!ray.clip(bBox, tMin, tMax))
+        return false;
+
+    // Hits are reported as squared distances
+    const float maxDistance = maxT*maxT*direction.getSquaredLength();
+
+    struct ToDo {
+        unsigned node;
+        float tMin, tMax;
+    } toDo[MAX_DEPTH];
+    unsigned toDoSize = 0;
+
+    unsigned node = 0;
+    while(true) {
+        const Node & n = nodes[node];
+        if(!n.isLeaf()) {
+            // Same order as intersect, closer blockers are found first
+            const Axis axis = n.getSplitAxis();
+            const float tPlane = (n.getSplit() - origin[axis]) * invDirection[axis];
+            const bool leftFirst = origin[axis] < n.getSplit() ||
+                (origin[axis] == n.getSplit() && direction[axis] <= 0);
+            const unsigned first = leftFirst ? n.getLeft() : n.getRight();
+            const unsigned second = leftFirst ? n.getRight() : n.getLeft();
+
+            if(tPlane > tMax || tPlane <= 0)
+                node = first;
+            else if(tPlane < tMin)
+                node = second;
+            else {
+                toDo[toDoSize++] = {second, tPlane, tMax};
+                node = first;
+                tMax = tPlane;
+            }
+            continue;
+        }
+
+        float distance = maxDistance;
+        if(intersectLeaf(n, origin, direction, distance) >= 0)
+            return true;
+
+        if(toDoSize == 0)
+            return false;
+        toDoSize--;
+        node = toDo[toDoSize].node;
+        tMin = toDo[toDoSize].tMin;
+        tMax = toDo[toDoSize].tMax;
+    }
+}
@@ -1,78 +1,239 @@
 #pragma once
 
 #include <vector>
-#include <tuple>
 
 #include "BoundingBox.h"
 #include "Ray.h"
 
-class Object;
+class Shape;
+class RayPacket;
 
 enum Axis {X = 0, Y = 1, Z = 2, NONE = -1};
 
 class KDtree {
-protected:
-    Object &o;
-    std::vector<unsigned> triangles;// sth only if leaf;
-    KDtree *left, *right;
-    Axis splitAxis;
-
 public:
+    /** How split planes are chosen while building */
+    enum Heuristic {
+        /** Middle of the longest axis, leaves of MIN_TRIANGLES */
+        MEDIAN,
+        /** Binned surface area heuristic, cost-based leaves */
+        SAH
+    };
+
+    /**
+     * Linearised node, 8 bytes
+     * Sons of an interior node are stored next to each other, left first
+     * Triangles of a leaf are a range of KDtree::getTriangles(),
+     * starting on a TriangleBlock
+     */
+    class Node {
+    public:
+        static inline Node interior(Axis axis, float split, unsigned sons) {
+            Node n;
+            n.split = split;
+            n.flags = (sons << 2) | unsigned(axis);
+            return n;
+        }
+        static inline Node leaf(unsigned firstTriangle, unsigned nbTriangles) {
+            Node n;
+            n.firstTriangle = firstTriangle;
+            n.flags = (nbTriangles << 2) | LEAF;
+            return n;
+        }
+
+        inline bool isLeaf() const { return (flags & LEAF) == LEAF; }
+        inline Axis getSplitAxis() const { return isLeaf() ? Axis::NONE : Axis(flags & LEAF); }
+        inline float getSplit() const { return split; }
+        inline unsigned getLeft() const { return flags >> 2; }
+        inline unsigned getRight() const { return (flags >> 2) + 1; }
+        inline unsigned getFirstTriangle() const { return firstTriangle; }
+        inline unsigned getNbTriangles() const { return flags >> 2; }
+
+    private:
+        static const unsigned LEAF = 3;
+
+        union {
+            float split;
+            unsigned firstTriangle;
+        };
+        /** 2 lower bits: axis or LEAF, others: sons or triangle count */
+        unsigned flags;
+    };
+
+    /**
+     * Leaf triangles, SIZE at a time, in structure of arrays
+     * Same vertices as Ray::intersect: edges go from the base to the two others
+     */
+    struct TriangleBlock {
+        static const unsigned SIZE = 4;
+        float base[3][SIZE];
+        float edgeU[3][SIZE];
+        float edgeV[3][SIZE];
+        /** In the mesh, -1 for padding */
+        int index[SIZE];
+    };
+
+    /**
+     * Edit of the mesh keeping the axes aligned, as scales and quarter turns
+     * Coordinates on axis a end on axis[a], multiplied by factor[a]
+     */
+    struct AxisMap {
+        unsigned axis[3];
+        float factor[3];
+        /** Vertices moved as planes, triangles need not be sent to the sons again */
+        bool isExact;
+
+        static AxisMap scale(float s);
+        static AxisMap scale(float s, unsigned axis);
+        /** As Mesh::rotate, identity if the rotation does not keep the axes aligned */
+        static AxisMap rotation(const Vec3Df &axis, float angle);
+    };
+
     static const unsigned MIN_TRIANGLES = 20;
-    const BoundingBox bBox;
+    /** Nodes with more triangles are built by several OpenMP tasks */
+    static const unsigned PARALLEL_TRIANGLES = 10000;
+    /** Also the size of the traversal stack */
+    static const unsigned MAX_DEPTH = 64;
+    /** Most triangle references a tree may hold, relative to the mesh triangles */
+    static constexpr float MAX_DUPLICATION = 3.f;
 
-    KDtree(Object &o);
+    // SAH parameters, relative to a traversal step
+    static const unsigned SAH_BINS = 32;
+    static constexpr float SAH_TRAVERSAL_COST = 1.f;
+    static constexpr float SAH_INTERSECTION_COST = 0.5f;
+    /** Cost reduction of a split cutting off empty space */
+    static constexpr float SAH_EMPTY_BONUS = 0.2f;
 
-    ~KDtree() {
-        delete left;
-        delete right;
-    }
+    /** Cost increase, per triangle, over which refit builds a subtree again */
+    static constexpr float REFIT_DEGRADATION = 1.25f;
 
-    Axis getSplitAxis() const { return splitAxis; };
-    std::tuple<const KDtree*, const KDtree*> getSons() const {
-        return std::make_tuple(left, right);
-    }
-    const KDtree* getLeft() const { return left; }
-    const KDtree* getRight() const { return right; }
-    const std::vector<unsigned> &  getTriangles() const { return triangles; }
+    BoundingBox bBox;
 
-    bool exec(bool (*f)(const KDtree *)) const {
-        return f(this) && (splitAxis == Axis::NONE ||
-                           (left->exec(f) && right->exec(f)));
-    }
-    void exec(void (*f)(const KDtree *)) const {
-        f(this);
-        if(splitAxis != Axis::NONE) {
-            left->exec(f);
-            right->exec(f);
-        }
-    }
-    void execLeaf(void (*f)(const KDtree *)) const {
-        if(splitAxis != Axis::NONE) {
-            left->exec(f);
-            right->exec(f);
-        }
-        else
-            f(this);
+    /** Loaded from the KDtreeCache when the mesh was already built */
+    KDtree(Shape &shape, Heuristic heuristic = SAH);
+
+    /**
+     * Follow an edit of the mesh vertices, triangles must be the same
+     * Planes are moved by map, triangles sent again to the sons unless it is exact,
+     * and subtrees which got worse than REFIT_DEGRADATION are built again
+     */
+    void refit(const AxisMap &map);
+
+    Heuristic getHeuristic() const { return heuristic; }
+    /** Root is the first one */
+    const std::vector<Node> & getNodes() const { return nodes; }
+    /** Leaves triangles, one range per leaf, padded to whole blocks */
+    const std::vector<unsigned> & getTriangles() const { return triangles; }
+    /** Block i holds triangles from i*TriangleBlock::SIZE */
+    const std::vector<TriangleBlock> & getBlocks() const { return blocks; }
+
+    /** Call f on the bounding box of every node */
+    void exec(void (*f)(const BoundingBox &)) const {
+        exec(0, bBox, f);
     }
 
     bool intersect(Ray &ray) const;
 
+    /** Closest intersection of every ray, traced together when they go the same way */
+    void intersect(RayPacket &packet) const;
+
+    /**
+     * Any hit query for shadows, stops at the first triangle hit
+     * closer than origin + maxT*direction
+     */
+    bool occlude(const Ray &ray, float maxT) const;
+
 private:
-    KDtree(Object &o, const std::vector<unsigned> &triangles,
-           const BoundingBox &boundingBox):
-        o(o), triangles(triangles),
-        left(nullptr), right(nullptr),
-        splitAxis(Axis::NONE),
-        bBox(boundingBox) {
-        next();
-    }
+    friend class KDtreeCache;
+
+    Shape &shape;
+    Heuristic heuristic;
+    std::vector<Node> nodes;
+    std::vector<unsigned> triangles;
+    std::vector<TriangleBlock> blocks;
+    /** Triangles crossing each node when it was built, to tell how much refits degrade it */
+    std::vector<unsigned> counts;
 
+    /** Subtree built by a task, with nodes and triangles numbered from its root */
+    struct Fragment {
+        std::vector<Node> nodes;
+        std::vector<unsigned> triangles;
+        std::vector<TriangleBlock> blocks;
+        std::vector<unsigned> counts;
+
+        /** Only the root */
+        Fragment(): nodes(1), counts(1) {}
+
+        /** Append two nodes, return the index of the first one */
+        unsigned addSons();
+        /** Append f, its root replaces nodes[node] */
+        void splice(unsigned node, const Fragment &f);
+        void swap(KDtree &tree);
+    };
+
+    KDtree(const KDtree &t) = delete;
     KDtree & operator=(const KDtree &t) = delete;
 
-    void next();
+    void exec(unsigned node, const BoundingBox &box, void (*f)(const BoundingBox &)) const;
+
+    /** Append a leaf and its triangle blocks */
+    void makeLeaf(Fragment &f, unsigned node, const std::vector<unsigned> &nodeTriangles) const;
+
+    /**
+     * Closest triangle of a leaf hit closer than distance, a squared one as in Ray
+     * distance is updated, return -1 if none
+     */
+    int intersectLeaf(const Node &n, const Vec3Df &origin, const Vec3Df &direction,
+                      float &distance) const;
+    /** Give ray the intersection with a triangle found by intersectLeaf */
+    inline bool setIntersection(Ray &ray, int triangle) const;
+
+#ifdef __SSE2__
+    /** One traversal for all the rays, which must be coherent */
+    void intersectPacket(RayPacket &packet) const;
+#endif
+
+    /**
+     * Fill f.nodes[node] and its subtree from the triangles touching box
+     * Triangles crossing a split go to both sons, as long as the subtree holds at most budget references
+     * Large sons are built in parallel
+     */
+    void build(Fragment &f, unsigned node, const std::vector<unsigned> &boxTriangles,
+               const BoundingBox &box, unsigned depthLeft, unsigned budget) const;
+    /**
+     * Fill f.nodes[node] from oldNode of the tree, once moved by map
+     * oldBox is the box of oldNode before the edit
+     */
+    void refit(Fragment &f, unsigned node, unsigned oldNode, const std::vector<unsigned> &boxTriangles,
+               const BoundingBox &oldBox, const BoundingBox &box, const AxisMap &map,
+               unsigned depthLeft) const;
+    /** Triangles of the leaves under node, once each */
+    void getTriangles(unsigned node, std::vector<unsigned> &nodeTriangles) const;
+    static unsigned getMaxDepth(unsigned nbTriangles);
 
-    inline void findSplitAxis();
-    inline void splitTriangles(const BoundingBox & lb, const BoundingBox & rb,
-                               std::vector<unsigned> &left, std::vector<unsigned> &right) const;
+    inline Axis findSplitAxis(const BoundingBox &box) const;
+    /** Return false if the node should stay a leaf */
+    bool findSAHSplit(const std::vector<BoundingBox> &bounds, const BoundingBox &box,
+                      unsigned depthLeft, Axis &axis, float &cut) const;
+    /** Surface area heuristic of a plane, not finite for boxes without area */
+    static inline float getSAHCost(const BoundingBox &box, unsigned axis, float cut,
+                                   unsigned nbLeft, unsigned nbRight);
+    /** Cheapest plane along an axis, cost is left unchanged if none beats it */
+    void findSAHSplit(const std::vector<BoundingBox> &bounds, const BoundingBox &box,
+                      unsigned axis, float &cost, float &cut) const;
+    /** Bounds of the part of a triangle inside box, false if it does not cross it */
+    bool clipTriangle(unsigned t, const BoundingBox &box, BoundingBox &bounds) const;
+    /** Keep triangles crossing box, with their clipped bounds */
+    void clipTriangles(const std::vector<unsigned> &boxTriangles, const BoundingBox &box,
+                       std::vector<unsigned> &nodeTriangles, std::vector<BoundingBox> &bounds) const;
+    static void splitTriangles(const std::vector<unsigned> &nodeTriangles,
+                               const std::vector<BoundingBox> &bounds, Axis axis, float cut,
+                               std::vector<unsigned> &left, std::vector<unsigned> &right);
+    /**
+     * Send triangles to left and/or right, as side(i, isInLeft, isInRight) says of nodeTriangles[i]
+     * Large nodes are cut in chunks, one task each
+     */
+    template <typename Side>
+    static void partition(const std::vector<unsigned> &nodeTriangles, Side side,
+                          std::vector<unsigned> &left, std::vector<unsigned> &right);
 };
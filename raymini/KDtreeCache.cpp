@@ -0,0 +1,134 @@
+#include <cstring>
+#include <QFile>
+#include <QDir>
+#include <QTemporaryFile>
+
+#include "KDtreeCache.h"
+#include "KDtree.h"
+#include "Shape.h"
+
+using namespace std;
+
+namespace {
+    struct Header {
+        char magic[4];
+        quint32 version;
+        quint64 key;
+        quint32 nbNodes;
+        quint32 nbTriangles;
+        quint32 nbBlocks;
+        quint32 padding;
+    };
+
+    const char MAGIC[4] = {'K', 'D', 'T', 'C'};
+
+    /** FNV-1a */
+    template <typename T>
+    inline void combine(unsigned long long &h, const T &value) {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&value);
+        for(unsigned i = 0 ; i < sizeof(T) ; i++) {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
+        }
+    }
+}
+
+unsigned long long KDtreeCache::getKey(const KDtree &tree) {
+    unsigned long long h = 14695981039346656037ull;
+    combine(h, unsigned(VERSION));
+    combine(h, unsigned(tree.heuristic));
+    combine(h, unsigned(KDtree::MIN_TRIANGLES));
+    combine(h, unsigned(KDtree::MAX_DEPTH));
+    combine(h, float(KDtree::MAX_DUPLICATION));
+    combine(h, unsigned(KDtree::SAH_BINS));
+    combine(h, float(KDtree::SAH_TRAVERSAL_COST));
+    combine(h, float(KDtree::SAH_INTERSECTION_COST));
+    combine(h, float(KDtree::SAH_EMPTY_BONUS));
+
+    const Mesh & mesh = tree.shape.getMesh();
+    for(const Vertex & v : mesh.getVertices()) {
+        const Vec3Df & p = v.getPos();
+        for(unsigned i = 0 ; i < 3 ; i++)
+            combine(h, p[i]);
+    }
+    for(const Triangle & t : mesh.getTriangles()) {
+        for(unsigned i = 0 ; i < 3 ; i++)
+            combine(h, t.getVertex(i));
+    }
+    return h;
+}
+
+QString KDtreeCache::getFileName(unsigned long long key) {
+    return QString("%1/%2.kdtree").arg(directory).arg(key, 16, 16, QChar('0'));
+}
+
+bool KDtreeCache::load(KDtree &tree) {
+    const unsigned long long key = getKey(tree);
+    QFile file(getFileName(key));
+    if(!file.open(QIODevice::ReadOnly) || file.size() < qint64(sizeof(Header)))
+        return false;
+    uchar *data = file.map(0, file.size());
+    if(!data)
+        return false;
+
+    Header header;
+    memcpy(&header, data, sizeof(Header));
+    const qint64 size = sizeof(Header) +
+        qint64(header.nbNodes)*sizeof(KDtree::Node) +
+        qint64(header.nbTriangles)*sizeof(unsigned) +
+        qint64(header.nbBlocks)*sizeof(KDtree::TriangleBlock) +
+        qint64(header.nbNodes)*sizeof(unsigned);
+    const bool isValid = !memcmp(header.magic, MAGIC, sizeof(MAGIC)) &&
+        header.version == VERSION && header.key == key && header.nbNodes > 0 &&
+        size == file.size();
+
+    if(isValid) {
+        const uchar *p = data + sizeof(Header);
+        const KDtree::Node *nodes = reinterpret_cast<const KDtree::Node *>(p);
+        tree.nodes.assign(nodes, nodes + header.nbNodes);
+        p += header.nbNodes*sizeof(KDtree::Node);
+        const unsigned *triangles = reinterpret_cast<const unsigned *>(p);
+        tree.triangles.assign(triangles, triangles + header.nbTriangles);
+        p += header.nbTriangles*sizeof(unsigned);
+        const KDtree::TriangleBlock *blocks = reinterpret_cast<const KDtree::TriangleBlock *>(p);
+        tree.blocks.assign(blocks, blocks + header.nbBlocks);
+        p += header.nbBlocks*sizeof(KDtree::TriangleBlock);
+        const unsigned *counts = reinterpret_cast<const unsigned *>(p);
+        tree.counts.assign(counts, counts + header.nbNodes);
+    }
+    file.unmap(data);
+    return isValid;
+}
+
+void KDtreeCache::save(const KDtree &tree) {
+    const unsigned long long key = getKey(tree);
+    if(!QDir().mkpath(directory))
+        return;
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.key = key;
+    header.nbNodes = tree.nodes.size();
+    header.nbTriangles = tree.triangles.size();
+    header.nbBlocks = tree.blocks.size();
+    header.padding = 0;
+
+    // Written aside then renamed, so that readers never see half a file
+    QTemporaryFile file(QString("%1/XXXXXX.tmp").arg(directory));
+    // Once renamed, removing it would remove the cached tree
+    file.setAutoRemove(false);
+    if(!file.open())
+        return;
+    auto write = [&](const void *data, qint64 size) {
+        return file.write(static_cast<const char *>(data), size) == size;
+    };
+    bool isWritten = write(&header, sizeof(Header)) &&
+        write(tree.nodes.data(), tree.nodes.size()*sizeof(KDtree::Node)) &&
+        write(tree.triangles.data(), tree.triangles.size()*sizeof(unsigned)) &&
+        write(tree.blocks.data(), tree.blocks.size()*sizeof(KDtree::TriangleBlock)) &&
+        write(tree.counts.data(), tree.counts.size()*sizeof(unsigned));
+    // Fails too if the same tree was saved meanwhile
+    if(!isWritten || !file.rename(getFileName(key)))
+        file.remove();
+}
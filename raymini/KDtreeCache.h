@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QString>
+
+class KDtree;
+
+/**
+ * Built KDtrees on disk, one file per mesh and build parameters
+ * Files are mapped in memory to be loaded
+ */
+class KDtreeCache {
+public:
+    /** Must be bumped whenever the builder or the file layout changes */
+    static const unsigned VERSION = 2;
+    /** Relative to the working directory, as models and textures */
+    static constexpr const char *directory = "cache";
+
+    /** Fill the tree from its file, false if there is none or it is stale */
+    static bool load(KDtree &tree);
+
+    /** Write the tree, a failure only costs a build next time */
+    static void save(const KDtree &tree);
+
+private:
+    /** Hash of the mesh geometry, the heuristic and the build constants */
+    static unsigned long long getKey(const KDtree &tree);
+    static QString getFileName(unsigned long long key);
+};
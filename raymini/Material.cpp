@@ -87,8 +87,8 @@ Vec3Df Material::genColor (const Vec3Df & camPos,
 Vec3Df Glass::genColor (const Vec3Df & camPos,
                         Ray *r,
                         const std::vector<Light> &lights, Brdf::Type type) const {
-    const Object *o = r->getIntersectedObject();
-    float size = o->getBoundingBox().getRadius();
+    Object *o = r->getIntersectedObject();
+    float size = o->getWorldBoundingBox().getRadius();
     const Vertex &closestIntersection = r->getIntersection();
     const Vec3Df & pos = closestIntersection.getPos();
     Vec3Df dir = camPos-pos;
@@ -99,15 +99,16 @@ Vec3Df Glass::genColor (const Vec3Df & camPos,
     dir.normalize();
 
     //Works well only for convex object
-    Ray ray(pos-o->getTrans()+3*size*dir, -dir);
+    Ray ray = o->getObjectRay(pos+3*size*dir, -dir, r->getTime());
     if (!o->getKDtree().intersect(ray)) {
         return controller->getRayTracer()->getColor(pos+size*dir, pos-camPos);
     }
 
+    ray.setObjectSpace(o, -dir);
     const Vertex i = ray.getIntersection();
     dir = (-dir).refract(coeff,-normalTexture->getNormal(&ray), 1);
 
-    Vec3Df glassColor = controller->getRayTracer()->getColor(dir, i.getPos()+o->getTrans(), false);
+    Vec3Df glassColor = controller->getRayTracer()->getColor(dir, i.getPos(), false);
 
     Vec3Df brdfColor = Vec3Df();
     // If at least slightly opaque
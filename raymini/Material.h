@@ -77,6 +77,7 @@ public:
         coeff(coeff),
         alpha(alpha) {}
 
+    inline float getCoeff() const {return coeff;}
     inline float getAlpha() const {return alpha;}
     inline void setAlpha(float a) {alpha = a;}
 
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Vec3D.h"
+
+/** 3x3 matrix stored by rows, for the linear part of object transforms */
+class Matrix {
+public:
+    /** Identity */
+    Matrix(): rows{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}} {}
+    Matrix(const Vec3Df &r0, const Vec3Df &r1, const Vec3Df &r2): rows{r0, r1, r2} {}
+
+    static Matrix scale(const Vec3Df &s) {
+        return Matrix({s[0], 0, 0}, {0, s[1], 0}, {0, 0, s[2]});
+    }
+    static Matrix scale(float s) {
+        return scale(Vec3Df(s, s, s));
+    }
+    /** Same as Vec3Df::rotate */
+    static Matrix rotation(const Vec3Df &axis, float angle) {
+        Vec3Df normalizedAxis = axis;
+        normalizedAxis.normalize();
+        Vec3Df columns[3];
+        for(unsigned i = 0 ; i < 3 ; i++) {
+            Vec3Df unit;
+            unit[i] = 1.f;
+            columns[i] = unit.rotate(normalizedAxis, angle);
+        }
+        return Matrix(columns[0], columns[1], columns[2]).transposed();
+    }
+
+    inline const Vec3Df & operator[](unsigned i) const { return rows[i]; }
+
+    inline Vec3Df operator*(const Vec3Df &v) const {
+        return Vec3Df(Vec3Df::dotProduct(rows[0], v),
+                      Vec3Df::dotProduct(rows[1], v),
+                      Vec3Df::dotProduct(rows[2], v));
+    }
+    inline Matrix operator*(const Matrix &m) const {
+        const Matrix t = m.transposed();
+        return Matrix(t*rows[0], t*rows[1], t*rows[2]);
+    }
+
+    inline Matrix transposed() const {
+        return Matrix({rows[0][0], rows[1][0], rows[2][0]},
+                      {rows[0][1], rows[1][1], rows[2][1]},
+                      {rows[0][2], rows[1][2], rows[2][2]});
+    }
+
+    /** Cofactors over the determinant, the matrix must not be singular */
+    Matrix inverse() const {
+        const Vec3Df c0 = Vec3Df::crossProduct(rows[1], rows[2]);
+        const Vec3Df c1 = Vec3Df::crossProduct(rows[2], rows[0]);
+        const Vec3Df c2 = Vec3Df::crossProduct(rows[0], rows[1]);
+        const float invDeterminant = 1.f/Vec3Df::dotProduct(rows[0], c0);
+        return Matrix(c0*invDeterminant, c1*invDeterminant, c2*invDeterminant).transposed();
+    }
+
+    inline bool isIdentity() const {
+        return rows[0] == Vec3Df(1, 0, 0) && rows[1] == Vec3Df(0, 1, 0) && rows[2] == Vec3Df(0, 0, 1);
+    }
+
+private:
+    Vec3Df rows[3];
+};
@@ -0,0 +1,110 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "MicroBuffer.h"
+#include "Surfel.h"
+
+using namespace std;
+
+/** Closer ones are the receiver itself */
+static const float MIN_DISTANCE = 0.01f;
+/** (axis+1)%3 and (axis+2)%3 of the face coordinates, without divisions */
+static const unsigned NEXT_AXIS[4] = {1, 2, 0, 1};
+
+MicroBuffer::MicroBuffer(const Vec3Df & pos, const Vec3Df & normal, unsigned res):
+    pos(pos),
+    res(res),
+    depths(6*res*res, numeric_limits<float>::max()),
+    colors(6*res*res)
+{
+    basis[0] = normal;
+    basis[1] = basis[0].getOrthogonal();
+    basis[2] = Vec3Df::crossProduct(basis[1], basis[0]);
+    for(unsigned int i = 0; i < 3; i++)
+        basis[i].normalize();
+}
+
+bool MicroBuffer::isBehind(const BoundingBox & box) const {
+    // Corner the furthest along the normal
+    Vec3Df corner;
+    for(unsigned int i = 0; i < 3; i++)
+        corner[i] = basis[0][i] > 0 ? box.getMax()[i] : box.getMin()[i];
+    return Vec3Df::dotProduct(corner - pos, basis[0]) <= 0;
+}
+
+void MicroBuffer::splat(const Surfel & s) {
+    const Vec3Df v = s.getPos() - pos;
+    Vec3Df local;
+    local[0] = Vec3Df::dotProduct(v, basis[0]);
+    if(local[0] <= 0)
+        return;
+    // Facing test of Octree, dot(normal, v) < -0.5*|v|, without the square root
+    const float squaredDistance = v.getSquaredLength();
+    const float facing = Vec3Df::dotProduct(s.getNormal(), v);
+    if(squaredDistance <= MIN_DISTANCE*MIN_DISTANCE || facing >= 0 || facing*facing <= 0.25f*squaredDistance)
+        return;
+    local[1] = Vec3Df::dotProduct(v, basis[1]);
+    local[2] = Vec3Df::dotProduct(v, basis[2]);
+
+    // Face of the main axis, discs crossing an edge stay on it
+    unsigned axis = 0;
+    if(fabs(local[1]) > fabs(local[axis])) axis = 1;
+    if(fabs(local[2]) > fabs(local[axis])) axis = 2;
+    const unsigned face = 2*axis + (local[axis] < 0);
+    const float inverseDepth = 1.f/fabs(local[axis]);
+    const float x = local[NEXT_AXIS[axis]]*inverseDepth;
+    const float y = local[NEXT_AXIS[axis+1]]*inverseDepth;
+    const float radius = s.getRadius()*inverseDepth;
+
+    // Pixel centers are at (2i+1)/res-1, truncation is enough once clamped to 0
+    const float halfRes = 0.5f*res;
+    auto toPixel = [&](float t) {
+        return min(int(res)-1, max(0, int((t+1)*halfRes)));
+    };
+    const int ci = toPixel(x), cj = toPixel(y);
+    const int iMin = toPixel(x-radius), iMax = toPixel(x+radius);
+    const int jMin = toPixel(y-radius), jMax = toPixel(y+radius);
+    // Most discs are far and smaller than a pixel
+    if(iMin == iMax && jMin == jMax) {
+        setClosest(getPixel(face, ci, cj), squaredDistance, s.getColor());
+        return;
+    }
+    const float pixelSize = 2.f/res;
+    for(int j = jMin; j <= jMax; j++) {
+        const float dy = (j+0.5f)*pixelSize - 1 - y;
+        for(int i = iMin; i <= iMax; i++) {
+            const float dx = (i+0.5f)*pixelSize - 1 - x;
+            if((i == ci && j == cj) || dx*dx + dy*dy <= radius*radius)
+                setClosest(getPixel(face, i, j), squaredDistance, s.getColor());
+        }
+    }
+}
+
+Vec3Df MicroBuffer::integrate(float intensity) const {
+    Vec3Df light;
+    const float pixelArea = 4.f/(res*res);
+    for(unsigned int face = 0; face < 6; face++) {
+        const unsigned axis = face/2;
+        for(unsigned int j = 0; j < res; j++) {
+            for(unsigned int i = 0; i < res; i++) {
+                const unsigned p = getPixel(face, i, j);
+                if(depths[p] == numeric_limits<float>::max())
+                    continue;
+                Vec3Df local;
+                local[axis] = face%2 ? -1.f : 1.f;
+                local[NEXT_AXIS[axis]] = (2*i+1)/float(res) - 1;
+                local[NEXT_AXIS[axis+1]] = (2*j+1)/float(res) - 1;
+                if(local[0] <= 0)
+                    continue;
+                // Pixel at distance l of the receiver on a face at distance 1:
+                // solid angle area/l^3, cosine local[0]/l
+                const float squaredLength = local.getSquaredLength();
+                const float weight = pixelArea*local[0]/(squaredLength*squaredLength);
+                light += weight*intensity/pow(1.f+sqrt(depths[p]), 3)*colors[p];
+            }
+        }
+    }
+    // Integral of the cosine over the hemisphere
+    return light/M_PI;
+}
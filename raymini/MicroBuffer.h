@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "Vec3D.h"
+#include "BoundingBox.h"
+
+class Surfel;
+
+/**
+ * Small cube map z-buffer around a PBGI receiver, res x res pixels per face
+ * Faces are in the frame of the receiver normal, surfels seen from the receiver are splatted into it
+ */
+class MicroBuffer {
+public:
+    MicroBuffer(const Vec3Df & pos, const Vec3Df & normal, unsigned res);
+
+    /** Whether a box lies entirely behind the receiver */
+    bool isBehind(const BoundingBox & box) const;
+
+    /**
+     * Keep the disc in the pixels it covers where it is the closest
+     * Discs behind the receiver or turned away from it are ignored, as rays would miss them
+     */
+    void splat(const Surfel & s);
+
+    /**
+     * Light of the pixels hit, intensity/(1+distance)^3 as the lights of ray casting,
+     * integrated over their solid angles with the cosine and divided by pi,
+     * so a hemisphere all of one light gives that light
+     */
+    Vec3Df integrate(float intensity) const;
+
+private:
+    Vec3Df pos;
+    /** Normal first */
+    Vec3Df basis[3];
+    unsigned res;
+    /** Squared distances of the closest discs */
+    std::vector<float> depths;
+    std::vector<Vec3Df> colors;
+
+    /** Pixels of face 2*axis+negative, row by row */
+    inline unsigned getPixel(unsigned face, unsigned i, unsigned j) const {
+        return (face*res + j)*res + i;
+    }
+    inline void setClosest(unsigned pixel, float squaredDistance, const Vec3Df & color) {
+        if(squaredDistance < depths[pixel]) {
+            depths[pixel] = squaredDistance;
+            colors[pixel] = color;
+        }
+    }
+};
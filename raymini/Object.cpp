@@ -11,25 +11,24 @@
 
 using namespace std;
 
-BoundingBox Object::computeBoundingBox(const Mesh & mesh) {
-    BoundingBox bbox;
-    const vector<Vertex> & V = mesh.getVertices ();
-    if (V.empty ())
-        bbox = BoundingBox ();
-    else {
-        bbox = BoundingBox (V[0].getPos ());
-        for (unsigned int i = 1; i < V.size (); i++)
-            bbox.extendTo (V[i].getPos ());
+Mesh & Object::getMesh() {
+    // Copy on write, other objects keep the shape as it was
+    if (shape.use_count() > 1) {
+        shape = make_shared<Shape>(shape->getMesh(), shape->getHeuristic());
     }
-    return bbox;
+    return shape->getMesh();
 }
 
-void Object::updateKDtree() {
-    updateBoundingBox();
-    if (tree) {
-        delete tree;
+BoundingBox Object::getWorldBoundingBox() const {
+    const BoundingBox & b = getBoundingBox();
+    BoundingBox world(toWorld(b.getMin()));
+    for (unsigned int i = 1; i < 8; i++) {
+        Vec3Df corner((i&1 ? b.getMax() : b.getMin())[0],
+                      (i&2 ? b.getMax() : b.getMin())[1],
+                      (i&4 ? b.getMax() : b.getMin())[2]);
+        world.extendTo(toWorld(corner));
     }
-    tree = new KDtree(*this);
+    return world;
 }
 
 SkyBox *SkyBox::generateSkyBox(const SkyBoxMaterial *m, string name) {
@@ -9,10 +9,13 @@
 
 #include <iostream>
 #include <vector>
+#include <memory>
 
 #include "Mesh.h"
 #include "BoundingBox.h"
 #include "KDtree.h"
+#include "Matrix.h"
+#include "Shape.h"
 #include "Brdf.h"
 #include "Light.h"
 #include "Material.h"
@@ -20,60 +23,94 @@
 
 class Ray;
 
+/**
+ * Instance of a shape in the scene, placed by linear then trans
+ * Objects built from the same shape share its mesh and KDtree
+ */
 class Object: public NamedClass {
 public:
     Object(const Mesh & mesh, const Material * mat, std::string name="No name",
-           const Vec3Df &trans=Vec3Df(), const Vec3Df &mobile=Vec3Df()):
+           const Vec3Df &trans=Vec3Df(), const Vec3Df &mobile=Vec3Df(),
+           KDtree::Heuristic heuristic=KDtree::SAH):
+        Object(std::make_shared<Shape>(mesh, heuristic), mat, name, trans, Matrix(), mobile) {}
+
+    Object(const std::shared_ptr<Shape> & shape, const Material * mat, std::string name="No name",
+           const Vec3Df &trans=Vec3Df(), const Matrix &linear=Matrix(),
+           const Vec3Df &mobile=Vec3Df()):
         NamedClass(name),
-        mesh (mesh), mat (mat), trans(trans), origTrans(trans),
-        tree(nullptr), mobile(mobile), enabled(true) {
-        updateBoundingBox ();
-        tree = new KDtree(*this);
+        shape(shape), mat (mat), trans(trans),
+        mobile(mobile), enabled(true) {
+        setLinear(linear);
     }
 
-    virtual ~Object () {
-        delete tree;
-    }
+    virtual ~Object () {}
 
+    /** Position at the start of the motion */
     inline const Vec3Df & getTrans () const { return trans;}
-    inline void setTrans (const Vec3Df & t) {
-        trans = t;
-        origTrans = trans;
+    inline void setTrans (const Vec3Df & t) { trans = t; }
+    /** Position at a time of the motion, from 0 to 1 */
+    inline Vec3Df getTrans (float time) const { return trans + time*mobile; }
+
+    /** Rotation and scale, applied before trans */
+    inline const Matrix & getLinear () const { return linear; }
+    inline void setLinear (const Matrix & m) {
+        linear = m;
+        inverse = m.inverse();
     }
 
-    inline void move(unsigned nbImages) { trans += mobile/nbImages ; }
-    inline void reset() { trans = origTrans; }
-
+    /** Mobile objects move by getMobile() while a picture is taken */
     inline bool isMobile() const {return mobile!=Vec3Df(); }
     inline void setMobile(const Vec3Df & mobile) { this->mobile = mobile; }
     inline Vec3Df getMobile() const {return mobile;}
 
-    inline const Mesh & getMesh () const { return mesh; }
-    inline Mesh & getMesh () { return mesh; }
+    inline const std::shared_ptr<Shape> & getShape () const { return shape; }
+
+    /** In object space */
+    inline const Mesh & getMesh () const { return shape->getMesh(); }
+    /** Gives this object its own copy of a shared shape */
+    Mesh & getMesh ();
 
     inline const Material & getMaterial () const { return *mat; }
     inline void setMaterial(const Material *material) {mat = material;}
 
-    inline const KDtree & getKDtree () const { return *tree; }
+    /** In object space, see getObjectRay */
+    inline const KDtree & getKDtree () const { return shape->getKDtree(); }
+
+    inline KDtree::Heuristic getHeuristic() const { return shape->getHeuristic(); }
+    /** Call updateKDtree to take it into account */
+    inline void setHeuristic(KDtree::Heuristic h) { shape->setHeuristic(h); }
 
     inline void setEnabled(bool e) { enabled = e; }
     inline bool isEnabled() const { return enabled; }
 
-    inline const BoundingBox & getBoundingBox () const { return bbox; }
-    void updateBoundingBox () { bbox = computeBoundingBox(mesh); }
-    static BoundingBox computeBoundingBox(const Mesh & mesh);
+    /** In object space */
+    inline const BoundingBox & getBoundingBox () const { return shape->getBoundingBox(); }
+    /** Bounds the object once placed, at the start of its motion */
+    BoundingBox getWorldBoundingBox () const;
+
+    /** Ray for the KDtree, hits have the same parameter along it as along the world ray */
+    inline Ray getObjectRay (const Vec3Df & origin, const Vec3Df & direction, float time = 0.f) const {
+        return Ray(inverse*(origin-getTrans(time)), inverse*direction, time);
+    }
+    inline Vec3Df toWorld (const Vec3Df & p, float time = 0.f) const { return linear*p + getTrans(time); }
+    inline Vec3Df normalToWorld (const Vec3Df & n) const {
+        Vec3Df normal = inverse.transposed()*n;
+        normal.normalize();
+        return normal;
+    }
 
-    void updateKDtree();
+    void updateKDtree() { shape->updateKDtree(); }
+    /** Faster than updateKDtree after moving vertices, map tells how they moved */
+    void refitKDtree(const KDtree::AxisMap &map) { shape->refitKDtree(map); }
 
 protected:
-    Mesh mesh;
+    std::shared_ptr<Shape> shape;
     const Material * mat;
 
 private:
-    BoundingBox bbox;
     Vec3Df trans;
-    Vec3Df origTrans;
-    KDtree *tree;
+    Matrix linear;
+    Matrix inverse;
     Vec3Df mobile;
     bool enabled;
 };
@@ -4,124 +4,212 @@
 #include "Scene.h"
 #include "Surfel.h"
 #include "Controller.h"
-#include "Texture.h"
 
 using namespace std;
 
-Octree::Octree(Controller * c, const PointCloud & cloud) : c(c), cloud(cloud) {
-    bBox = c->getScene()->getBoundingBox();
-
-    surfels.resize(cloud.getSurfels().size());
-    for(int i = 0; i < 8; i++)
-        sons[i] = nullptr;
+Octree::Octree(Controller * c, const PointCloud & cloud) :
+    bBox(c->getScene()->getBoundingBox()), cloud(cloud), nodes(1) {
+    vector<unsigned> all(cloud.getSurfels().size());
     for(unsigned int i = 0 ; i < cloud.getSurfels().size() ; i++)
-        surfels[i] = i;
-    next();
+        all[i] = i;
+    nodes[0].parent = 0;
+    build(0, all, bBox, MAX_DEPTH);
+    aggregate();
 }
 
-void Octree::next() {
-    if(surfels.size() <= MIN_SURFELS) return;//leaf
+void Octree::build(unsigned node, const vector<unsigned> & nodeSurfels,
+                   const BoundingBox & box, unsigned depthLeft) {
+    float radius = 0.f;
+    for(unsigned surfel : nodeSurfels)
+        radius = max(radius, cloud.getSurfels()[surfel].getRadius());
+    Vec3Df margin(radius, radius, radius);
+    nodes[node].hitBox = BoundingBox(box.getMin() - margin, box.getMax() + margin);
+
+    if(nodeSurfels.size() <= MIN_SURFELS || depthLeft == 0) {
+        nodes[node].first = surfels.size();
+        nodes[node].flags = (nodeSurfels.size() << 1) | Node::LEAF;
+        surfels.insert(surfels.end(), nodeSurfels.begin(), nodeSurfels.end());
+        return;
+    }
 
     array<BoundingBox, 8> s;
-    bBox.subdivide(s);
+    box.subdivide(s);
 
-    array<vector<unsigned>, 8> array_surfels;
-    splitSurfels(s, array_surfels);
-    
-    surfels.clear(); //not a leaf
+    array<vector<unsigned>, 8> sonSurfels;
+    splitSurfels(nodeSurfels, s, sonSurfels);
 
-    for(unsigned int index = 0; index < 8; index++) {
-        sons[index] = new Octree(c, cloud, array_surfels[index], s[index]);
+    // Building sons may grow nodes, no reference on them is kept
+    const unsigned sons = nodes.size();
+    nodes.resize(sons+8);
+    nodes[node].first = sons;
+    nodes[node].flags = 0;
+    for(unsigned int i = 0; i < 8; i++) {
+        nodes[sons+i].parent = node;
+        build(sons+i, sonSurfels[i], s[i], depthLeft-1);
     }
 }
 
-void Octree::exec(void (*f)(const Octree * octree)) const {
-    f(this);
-    if(!isLeaf()) {
-        for(unsigned int i = 0; i < 8; i++) {
-            (sons[i])->exec(f);
-        }
+void Octree::exec(unsigned node, const BoundingBox &box, void (*f)(const BoundingBox &)) const {
+    f(box);
+    const Node &n = nodes[node];
+    if(!n.isLeaf()) {
+        array<BoundingBox, 8> s;
+        box.subdivide(s);
+        for(unsigned int i = 0; i < 8; i++)
+            exec(n.getSons()+i, s[i], f);
     }
 }
 
-void Octree::splitSurfels(const array<BoundingBox, 8> & bBoxes, array<vector<unsigned>, 8> & array_surfels) {
-
-    for(unsigned surfel : surfels) {
+void Octree::splitSurfels(const vector<unsigned> & nodeSurfels, const array<BoundingBox, 8> & bBoxes,
+                          array<vector<unsigned>, 8> & sonSurfels) const {
+    for(unsigned surfel : nodeSurfels) {
         const Vec3Df & p = cloud.getSurfels()[surfel].getPos();
         for(unsigned int j = 0; j < 8; j++) {
             if(bBoxes[j].contains(p)) {
-                array_surfels[j].push_back(surfel);
+                sonSurfels[j].push_back(surfel);
             }
         }
     }
 }
 
-Surfel Octree::getMeanSurfel() const {
-    // TODO fix memory leaks
-    Vec3Df p, n, color;
-    float radius (0.0);
-    auto normalTexture = new MeshNormalTexture();
-    if(isLeaf()) {
-        for(unsigned index_surfel: surfels) {
-            Surfel s = cloud.getSurfels() [index_surfel];
-            p += s.getPos();
-            n += s.getNormal();
-            radius += s.getRadius();
-            color += s.getColor();
+void Octree::aggregate() {
+    const Surfel none(Vec3Df(), Vec3Df(), 0.f, Vec3Df());
+    meanSurfels.assign(nodes.size(), none);
+    normalCones.assign(nodes.size(), 1.f);
+
+    // Sums over the surfels of each node, sons come after their father
+    vector<unsigned> counts(nodes.size(), 0);
+    vector<float> areas(nodes.size(), 0.f);
+    vector<Vec3Df> positions(nodes.size()), normals(nodes.size()), colors(nodes.size());
+    for(unsigned node = nodes.size() ; node-- > 0 ;) {
+        const Node &n = nodes[node];
+        if(n.isLeaf()) {
+            for(unsigned i = n.getFirstSurfel(); i < n.getFirstSurfel()+n.getNbSurfels(); i++) {
+                const Surfel & s = cloud.getSurfels()[surfels[i]];
+                positions[node] += s.getPos();
+                normals[node] += s.getNormal();
+                areas[node] += s.getRadius()*s.getRadius();
+                colors[node] += s.getColor();
+            }
+            counts[node] = n.getNbSurfels();
         }
-        n.normalize();
-        return Surfel(p/surfels.size(), n, radius/surfels.size(), color/surfels.size(), new Material(c, "Surfel", 1.0f, 0.0f, new SingleColorTexture(color/255.0), normalTexture));
-    }
-    for(unsigned int i = 0; i < 8; i++) {
-        Surfel s = sons[i]->getMeanSurfel();
-        p += s.getPos();
-        n += s.getNormal();
-        radius += s.getRadius();
-        color += s.getColor();
+        else {
+            for(unsigned int i = n.getSons(); i < n.getSons()+8; i++) {
+                positions[node] += positions[i];
+                normals[node] += normals[i];
+                areas[node] += areas[i];
+                colors[node] += colors[i];
+                counts[node] += counts[i];
+            }
+        }
+        if(counts[node] == 0)
+            continue;
+
+        Vec3Df normal = normals[node];
+        const bool hasNormal = normal.getSquaredLength() > 0.f;
+        if(hasNormal)
+            normal.normalize();
+        meanSurfels[node] = Surfel(positions[node]/counts[node], normal, sqrt(areas[node]),
+                                   colors[node]/counts[node]);
+
+        // Sons cones widened by the angle between the mean normals
+        float cone = 1.f;
+        if(!hasNormal) {
+            cone = -1.f;
+        }
+        else if(n.isLeaf()) {
+            for(unsigned i = n.getFirstSurfel(); i < n.getFirstSurfel()+n.getNbSurfels(); i++)
+                cone = min(cone, Vec3Df::dotProduct(normal, cloud.getSurfels()[surfels[i]].getNormal()));
+        }
+        else {
+            float angle = 0.f;
+            for(unsigned int i = n.getSons(); i < n.getSons()+8; i++) {
+                if(counts[i] == 0)
+                    continue;
+                float cosine = max(-1.f, min(1.f, Vec3Df::dotProduct(normal, meanSurfels[i].getNormal())));
+                angle = max(angle, acos(cosine) + acos(normalCones[i]));
+            }
+            cone = angle < M_PI ? cos(angle) : -1.f;
+        }
+        normalCones[node] = cone;
     }
-    n.normalize();
-    return Surfel(p/8.0, n, radius/8.0, color/8.0, new Material(c, "Surfel", 1.0f, 0.0f, new SingleColorTexture(color/255.0), normalTexture));
 }
 
-bool Octree::sort_octree(pair<float, bool> p1, pair<float, bool> p2) {
-    return (p1.first < p2.first);
+bool Octree::intersectSurfel(const Surfel &s, Ray &ray) {
+    return Vec3Df::dotProduct(s.getNormal(), ray.getDirection()) < -0.5 &&
+           ray.intersectDisc(s.getPos(), s.getNormal(), s.getRadius());
 }
 
-const Octree * Octree::intersect(Ray &ray) const {
-
-    if(isLeaf()) {
-        for(unsigned index_surfel : surfels) {
-            Surfel s = cloud.getSurfels()[index_surfel];
-            if(Vec3Df::dotProduct(s.getNormal(), ray.getDirection()) < -0.5) {
-                if(ray.intersectDisc(s.getPos(), s.getNormal(), s.getRadius())) {
-                    return this;
-                }
-            }
+bool Octree::intersectLeaf(const Node &n, Ray &ray) const {
+    for(unsigned i = n.getFirstSurfel(); i < n.getFirstSurfel()+n.getNbSurfels(); i++) {
+        if(intersectSurfel(cloud.getSurfels()[surfels[i]], ray)) {
+            return true;
         }
-        return nullptr;
     }
-    else {
-        array<pair<float, unsigned int>, 8> pair_intersection;
-        array<Vec3Df, 8> inter_pos;
-        array<bool, 8> is_intersected;
-
-        for(unsigned int i = 0; i < 8; i++) {
-            pair_intersection[i].second = i;
-            is_intersected[i] = ray.intersect(sons[i]->bBox, inter_pos[i]);
-            pair_intersection[i].first = Vec3Df::squaredDistance (inter_pos[i], ray.getOrigin());
-        }
+    return false;
+}
 
-        sort(pair_intersection.begin(), pair_intersection.end(), Octree::sort_octree);
+bool Octree::isCut(unsigned node, const Vec3Df &origin, float maxSolidAngle) const {
+    if(normalCones[node] < CUT_NORMAL_CONE || nodes[node].hitBox.contains(origin))
+        return false;
+    // Disc of the mean surfel, seen face on
+    const Surfel &s = meanSurfels[node];
+    float squaredDistance = Vec3Df::squaredDistance(origin, s.getPos());
+    return M_PI*s.getRadius()*s.getRadius() < maxSolidAngle*squaredDistance;
+}
 
-        for(unsigned int i = 0; i < 8; i++) {
-            const Octree * octree (nullptr);
-            if(is_intersected[pair_intersection[i].second]) {
-                if((octree = sons[pair_intersection[i].second]->intersect(ray)) != nullptr)
-                    return octree;
+int Octree::intersect(Ray &ray, float maxSolidAngle) const {
+    float tMin, tMax;
+    if(!ray.intersect(nodes[0].hitBox, tMin, tMax))
+        return -1;
+
+    // Sons rank^mask for ranks from 0 to 7 are front to back: in the frame flipped by mask
+    // the ray crosses middle planes from low to high only, setting bits of the son it is in
+    unsigned mask = 0;
+    for(unsigned int a = 0; a < 3; a++)
+        if(ray.isNegative(a))
+            mask |= 1 << a;
+
+    // First son of n from rank on which the ray may hit, 8 if none
+    auto nextRank = [&](const Node &n, unsigned rank) {
+        for(; rank < 8; rank++) {
+            const Node &son = nodes[n.getSons() + (rank^mask)];
+            if(!(son.isLeaf() && son.getNbSurfels() == 0) && ray.intersect(son.hitBox, tMin, tMax))
+                break;
+        }
+        return rank;
+    };
+
+    unsigned node = 0;
+    while(true) {
+        const Node &n = nodes[node];
+        if(n.isLeaf()) {
+            if(intersectLeaf(n, ray))
+                return node;
+        }
+        else if(isCut(node, ray.getOrigin(), maxSolidAngle)) {
+            if(intersectSurfel(meanSurfels[node], ray))
+                return node;
+        }
+        else {
+            const unsigned rank = nextRank(n, 0);
+            if(rank < 8) {
+                node = n.getSons() + (rank^mask);
+                continue;
             }
         }
 
-        return nullptr;
+        // Next sibling, or that of the first father having one left
+        while(true) {
+            if(node == 0)
+                return -1;
+            const Node &father = nodes[nodes[node].getParent()];
+            const unsigned rank = nextRank(father, ((node - father.getSons())^mask) + 1);
+            if(rank < 8) {
+                node = father.getSons() + (rank^mask);
+                break;
+            }
+            node = nodes[node].getParent();
+        }
     }
 }
-
@@ -5,54 +5,106 @@
 #include "Vec3D.h"
 #include "BoundingBox.h"
 #include "Ray.h"
+#include "Surfel.h"
 
 class PointCloud;
-class Surfel;
 class Controller;
 
+/**
+ * Octree over the surfels of a point cloud, for PBGI
+ * Nodes are linearised, the 8 sons of a node are stored next to each other
+ * Son i is on the high side of the middle along axis a if bit a of i is set,
+ * as BoundingBox::subdivide orders them
+ */
 class Octree {
-protected:
-    Controller * c;
-    const PointCloud & cloud;
-    std::vector<unsigned> surfels;// sth only if leaf;
-    std::array<Octree *, 8> sons;
-
 public:
     static const unsigned MIN_SURFELS = 16;
+    /** Surfels at the same place stop the subdivision there */
+    static const unsigned MAX_DEPTH = 20;
+    /** Nodes with a wider normal cone are always opened, their mean surfel is a poor stand-in */
+    static constexpr float CUT_NORMAL_CONE = 0.5f;
+
+    class Node {
+    public:
+        /** Box of the node grown by the radius of its surfels, discs can stick out */
+        BoundingBox hitBox;
+
+        inline bool isLeaf() const { return (flags & LEAF) == LEAF; }
+        /** Index of the first son */
+        inline unsigned getSons() const { return first; }
+        inline unsigned getFirstSurfel() const { return first; }
+        inline unsigned getNbSurfels() const { return flags >> 1; }
+        /** The root is its own parent */
+        inline unsigned getParent() const { return parent; }
+
+    private:
+        friend class Octree;
+        static const unsigned LEAF = 1;
+
+        unsigned parent;
+        /** Sons or surfels */
+        unsigned first;
+        /** Lower bit: LEAF, others: surfel count */
+        unsigned flags;
+    };
+
     BoundingBox bBox;
 
     Octree(Controller * c, const PointCloud &p);
 
-    ~Octree() {
-        for(Octree * & o:sons) {
-            if(o != nullptr)
-                delete o;
-        }
-    }
+    /** Root is the first one */
+    const std::vector<Node> & getNodes() const { return nodes; }
+    /** Leaves surfels, in the point cloud, one range per leaf */
+    const std::vector<unsigned> & getSurfels() const { return surfels; }
 
-    const std::array<Octree*, 8> getSons() const { return sons; }
-    const std::vector<unsigned> &  getSurfels() const { return surfels; }
-    bool isLeaf() const {return (sons[0] == nullptr);}
-    Surfel getMeanSurfel() const; 
-    const Octree * intersect(Ray &ray) const;
-    static bool sort_octree(std::pair<float, bool> p1, std::pair<float, bool> p2);
-    
-    // useful to draw an Octree
-    void exec(void (*f)(const Octree * octree)) const;
+    /**
+     * Surfels of a node summed up: mean position, normal and color,
+     * radius of a disc of their whole area
+     */
+    inline const Surfel & getMeanSurfel(unsigned node) const { return meanSurfels[node]; }
+    /** Cosine of the widest angle between the mean normal of a node and those of its surfels */
+    inline float getNormalCone(unsigned node) const { return normalCones[node]; }
 
-private:
-    Octree(Controller * c, const PointCloud & cloud, const std::vector<unsigned> & surfels,
-           const BoundingBox & b):
-        c(c), cloud(cloud), surfels(surfels),
-        bBox(b) {
-        for(int i = 0; i < 8; i++)
-            sons[i] = nullptr;
-        next();
+    /**
+     * Node holding the first disc hit by ray, -1 if none
+     * Nodes seen from the ray origin under less than maxSolidAngle are not opened,
+     * their mean surfel is hit instead, 0 goes down to the leaves
+     * Sons are crossed front to back without a stack
+     */
+    int intersect(Ray &ray, float maxSolidAngle = 0.f) const;
+
+    /**
+     * Whether an interior node seen from origin stands for all its surfels
+     * with its mean surfel, as intersect decides it
+     */
+    bool isCut(unsigned node, const Vec3Df &origin, float maxSolidAngle) const;
+
+    /** Call f on the box of every node, useful to draw an Octree */
+    void exec(void (*f)(const BoundingBox &)) const {
+        exec(0, bBox, f);
     }
 
-    Octree & operator=(const Octree &t) = delete;
+private:
+    const PointCloud & cloud;
+    std::vector<Node> nodes;
+    std::vector<unsigned> surfels;
+    std::vector<Surfel> meanSurfels;
+    std::vector<float> normalCones;
 
-    void next();
-    void splitSurfels(const std::array<BoundingBox, 8> & bBoxes, std::array<std::vector<unsigned>, 8> & t);
+    Octree(const Octree &t) = delete;
+    Octree & operator=(const Octree &t) = delete;
 
+    /** Fill nodes[node] from the surfels inside box */
+    void build(unsigned node, const std::vector<unsigned> & nodeSurfels,
+               const BoundingBox & box, unsigned depthLeft);
+    /** Fill meanSurfels and normalCones, sons first */
+    void aggregate();
+    void exec(unsigned node, const BoundingBox &box, void (*f)(const BoundingBox &)) const;
+    /** First surfel of a leaf hit by ray */
+    bool intersectLeaf(const Node &n, Ray &ray) const;
+    /** Only discs facing the ray are hit */
+    static inline bool intersectSurfel(const Surfel &s, Ray &ray);
+    void splitSurfels(const std::vector<unsigned> & nodeSurfels,
+                      const std::array<BoundingBox, 8> & bBoxes,
+                      std::array<std::vector<unsigned>, 8> & t) const;
 };
@@ -1,5 +1,6 @@
 #include <vector>
 #include "PBGI.h"
+#include "MicroBuffer.h"
 #include "Scene.h"
 #include "Controller.h"
 
@@ -9,13 +10,15 @@ vector<Light> PBGI::getLights(Ray & r) const {
     Vec3Df color;
     vector<Light> light;
     vector<Vec3Df> directions = r.getIntersection().getDirectionsOnCube(res);
+    // Each direction of the cube map covers about the same part of the sphere
+    const float maxSolidAngle = cutRatio*4*M_PI/directions.size();
     for(const Vec3Df & dir: directions) {
         // we look at the half hemisphere
         if(Vec3Df::dotProduct(dir, r.getIntersection().getNormal()) > 0.0) {
             Ray rayCube(r.getIntersection().getPos() + 0.01*dir, dir);
-            const Octree * o = octree->intersect(rayCube);
-            if(o && rayCube.getIntersectionDistance() > 0.01) {
-                Surfel s = o->getMeanSurfel();
+            int node = octree->intersect(rayCube, maxSolidAngle);
+            if(node >= 0 && rayCube.getIntersectionDistance() > 0.01) {
+                const Surfel & s = octree->getMeanSurfel(node);
                 float intensity = c->getRayTracer()->getIntensityPathTracing()/pow(1.0+rayCube.getIntersectionDistance(),3);
                 light.push_back(Light(s.getPos(), s.getColor(), intensity));
             }
@@ -24,3 +27,47 @@ vector<Light> PBGI::getLights(Ray & r) const {
 
     return light;
 }
+
+Vec3Df PBGI::getIrradiance(Ray & r) const {
+    const Vertex receiver = r.getIntersection();
+    MicroBuffer buffer(receiver.getPos(), receiver.getNormal(), res);
+    // Same cut as getLights, a pixel covers about a cube map direction
+    const float maxSolidAngle = cutRatio*4*M_PI/(6*res*res);
+
+    const vector<Octree::Node> & nodes = octree->getNodes();
+    const vector<Surfel> & cloudSurfels = cloud->getSurfels();
+    // Order does not matter with a z-buffer, at most 7 sons wait per level
+    unsigned toDo[7*Octree::MAX_DEPTH + 1];
+    unsigned nbToDo = 0;
+    toDo[nbToDo++] = 0;
+    while(nbToDo) {
+        const unsigned node = toDo[--nbToDo];
+        const Octree::Node & n = nodes[node];
+        if((n.isLeaf() && n.getNbSurfels() == 0) || buffer.isBehind(n.hitBox))
+            continue;
+        if(n.isLeaf()) {
+            for(unsigned i = 0; i < n.getNbSurfels(); i++)
+                buffer.splat(cloudSurfels[octree->getSurfels()[n.getFirstSurfel() + i]]);
+        }
+        else if(octree->isCut(node, receiver.getPos(), maxSolidAngle))
+            buffer.splat(octree->getMeanSurfel(node));
+        else {
+            for(unsigned i = 0; i < 8; i++)
+                toDo[nbToDo++] = n.getSons() + i;
+        }
+    }
+
+    return buffer.integrate(c->getRayTracer()->getIntensityPathTracing());
+}
+
+Vec3Df PBGI::getRadiance(const Vec3Df & pos, const Vec3Df & dir, float maxSolidAngle, float & distance) const {
+    Ray ray(pos + 0.01*dir, dir);
+    int node = octree->intersect(ray, maxSolidAngle);
+    if(node < 0 || ray.getIntersectionDistance() <= 0.01) {
+        distance = 0.f;
+        return Vec3Df();
+    }
+    distance = ray.getIntersectionDistance();
+    float intensity = c->getRayTracer()->getIntensityPathTracing()/pow(1.0+distance, 3);
+    return intensity*octree->getMeanSurfel(node).getColor();
+}
@@ -12,7 +12,15 @@ class PBGI: public Observable {
 public:
     static const unsigned long PBGI_CHANGED = 1<<0;
 
-    PBGI(Controller * c, unsigned int res = 6) : c(c), res(res){
+    /** How a receiver gathers the light of the surfels */
+    enum Gather {
+        /** One ray through the octree per cube map direction, each hit is a Light */
+        RAY_CASTING,
+        /** Surfels and cut nodes rasterised in a MicroBuffer around the receiver */
+        MICRO_BUFFER
+    };
+
+    PBGI(Controller * c, unsigned int res = 6) : c(c), res(res), cutRatio(1.f), gather(RAY_CASTING) {
         cloud = new PointCloud(c);
         cloud->generatePoints();
         octree = new Octree(c, *cloud);
@@ -25,7 +33,33 @@ public:
     Octree * getOctree() const {return octree;}
     PointCloud * getPointCloud() const {return cloud;}
     std::vector<Light> getLights(Ray & r) const;
+    /**
+     * Light reaching the intersection of r, to be multiplied by the diffuse color
+     * Same brightness as the Lambert term of getLights
+     */
+    Vec3Df getIrradiance(Ray & r) const;
+    /**
+     * Light of the first surfel seen from pos along dir, weighted as in getLights,
+     * distance is how far it is, 0 if none
+     */
+    Vec3Df getRadiance(const Vec3Df & pos, const Vec3Df & dir, float maxSolidAngle, float & distance) const;
     void setResolution(unsigned int r) {res = r;}
+    /**
+     * Octree nodes seen under less than cutRatio times the solid angle
+     * of a cube map direction stand for all their surfels, 0 uses every surfel
+     */
+    float getCutRatio() const {return cutRatio;}
+    /** Change PBGI_CHANGED */
+    void setCutRatio(float r) {
+        cutRatio = r;
+        setChanged(PBGI_CHANGED);
+    }
+    Gather getGather() const {return gather;}
+    /** Change PBGI_CHANGED */
+    void setGather(Gather g) {
+        gather = g;
+        setChanged(PBGI_CHANGED);
+    }
 
     void update() {
         if (cloud) {
@@ -43,6 +77,8 @@ public:
 private:
     Controller * c;
     unsigned int res;
+    float cutRatio;
+    Gather gather;
     PointCloud * cloud;
     Octree * octree;
 };
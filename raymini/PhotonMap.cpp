@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+
+#include "PhotonMap.h"
+
+using namespace std;
+
+void PhotonMap::build() {
+    build(0, photons.size());
+}
+
+void PhotonMap::build(unsigned begin, unsigned end) {
+    if(end - begin < 2) {
+        if(begin < end)
+            photons[begin].axis = 0;
+        return;
+    }
+
+    // Split the longest axis of the range at its median photon
+    Vec3Df minPos = photons[begin].pos, maxPos = photons[begin].pos;
+    for(unsigned i = begin + 1; i < end; i++) {
+        for(unsigned a = 0; a < 3; a++) {
+            minPos[a] = min(minPos[a], photons[i].pos[a]);
+            maxPos[a] = max(maxPos[a], photons[i].pos[a]);
+        }
+    }
+    const Vec3Df extent = maxPos - minPos;
+    unsigned axis = 0;
+    if(extent[1] > extent[axis]) axis = 1;
+    if(extent[2] > extent[axis]) axis = 2;
+
+    const unsigned middle = (begin + end)/2;
+    nth_element(photons.begin() + begin, photons.begin() + middle, photons.begin() + end,
+                [axis](const Photon & a, const Photon & b) { return a.pos[axis] < b.pos[axis]; });
+    photons[middle].axis = axis;
+
+    build(begin, middle);
+    build(middle + 1, end);
+}
+
+Vec3Df PhotonMap::getIrradiance(const Vec3Df & pos, const Vec3Df & normal,
+                                unsigned nbNearest, float maxRadius) const {
+    vector<pair<float, unsigned>> nearest;
+    nearest.reserve(nbNearest);
+    float maxSquaredDistance = maxRadius*maxRadius;
+    findNearest(0, photons.size(), pos, nbNearest, nearest, maxSquaredDistance);
+    if(nearest.empty())
+        return Vec3Df();
+
+    Vec3Df power;
+    for(const auto & n : nearest) {
+        const Photon & p = photons[n.second];
+        if(Vec3Df::dotProduct(p.direction, normal) < 0)
+            power += p.power;
+    }
+    // Disc up to the farthest photon kept, or the whole search when there are too few
+    const float squaredRadius = nearest.size() == nbNearest ? nearest.front().first : maxRadius*maxRadius;
+    return power/(M_PI*squaredRadius);
+}
+
+void PhotonMap::findNearest(unsigned begin, unsigned end, const Vec3Df & pos, unsigned nbNearest,
+                            vector<pair<float, unsigned>> & nearest, float & maxSquaredDistance) const {
+    if(begin >= end)
+        return;
+
+    const unsigned middle = (begin + end)/2;
+    const Photon & p = photons[middle];
+    const float split = pos[p.axis] - p.pos[p.axis];
+    // Closer side first, it shrinks the search
+    if(split < 0)
+        findNearest(begin, middle, pos, nbNearest, nearest, maxSquaredDistance);
+    else
+        findNearest(middle + 1, end, pos, nbNearest, nearest, maxSquaredDistance);
+
+    const float squaredDistance = Vec3Df::squaredDistance(pos, p.pos);
+    if(squaredDistance < maxSquaredDistance) {
+        if(nearest.size() == nbNearest) {
+            pop_heap(nearest.begin(), nearest.end());
+            nearest.pop_back();
+        }
+        nearest.push_back({squaredDistance, middle});
+        push_heap(nearest.begin(), nearest.end());
+        if(nearest.size() == nbNearest)
+            maxSquaredDistance = nearest.front().first;
+    }
+
+    if(split*split < maxSquaredDistance) {
+        if(split < 0)
+            findNearest(middle + 1, end, pos, nbNearest, nearest, maxSquaredDistance);
+        else
+            findNearest(begin, middle, pos, nbNearest, nearest, maxSquaredDistance);
+    }
+}
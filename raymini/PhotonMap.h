@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "Vec3D.h"
+
+/**
+ * Photons stored on diffuse surfaces, in a balanced kd-tree for density estimation
+ * The tree is implicit: the photon in the middle of a range splits it,
+ * along the axis it keeps, the two halves being its sons
+ */
+class PhotonMap {
+public:
+    struct Photon {
+        Vec3Df pos;
+        /** Where the photon goes to */
+        Vec3Df direction;
+        Vec3Df power;
+        /** Split axis once built */
+        unsigned axis;
+    };
+
+    /** Photons are added in any order, then built once */
+    void add(const std::vector<Photon> & p) { photons.insert(photons.end(), p.begin(), p.end()); }
+    void build();
+    void clear() { photons.clear(); }
+
+    unsigned getNbPhotons() const { return photons.size(); }
+    const std::vector<Photon> & getPhotons() const { return photons; }
+
+    /**
+     * Power of the nbNearest photons closest to pos, within maxRadius, reaching
+     * the front of a surface of this normal, divided by the area of the disc they cover
+     */
+    Vec3Df getIrradiance(const Vec3Df & pos, const Vec3Df & normal,
+                         unsigned nbNearest, float maxRadius) const;
+
+private:
+    std::vector<Photon> photons;
+
+    void build(unsigned begin, unsigned end);
+
+    /**
+     * Keep in nearest, a max heap of squared distances and photons, the nbNearest photons
+     * of [begin, end) closest to pos, maxSquaredDistance shrinks once it is full
+     */
+    void findNearest(unsigned begin, unsigned end, const Vec3Df & pos, unsigned nbNearest,
+                     std::vector<std::pair<float, unsigned>> & nearest, float & maxSquaredDistance) const;
+};
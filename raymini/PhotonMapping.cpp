@@ -0,0 +1,243 @@
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <functional>
+
+#include "PhotonMapping.h"
+#include "Controller.h"
+#include "Scene.h"
+#include "Ray.h"
+
+using namespace std;
+
+static float uniformRandom(minstd_rand & random) {
+    return uniform_real_distribution<float>()(random);
+}
+
+/** Direction of spherical coordinates around axis */
+static Vec3Df getDirection(const Vec3Df & axis, float cosTheta, float phi) {
+    Vec3Df u = axis.getOrthogonal();
+    u.normalize();
+    const Vec3Df v = Vec3Df::crossProduct(axis, u);
+    const float sinTheta = sqrt(max(0.f, 1.f - cosTheta*cosTheta));
+    return sinTheta*(cos(phi)*u + sin(phi)*v) + cosTheta*axis;
+}
+
+/** Cone around a sphere seen from a point, everything from inside it */
+struct Cone {
+    Vec3Df axis;
+    float cosMax;
+
+    Cone(const Vec3Df & origin, const BoundingBox & box) {
+        axis = box.getCenter() - origin;
+        const float distance = axis.getLength();
+        const float radius = box.getRadius();
+        axis.normalize();
+        cosMax = distance > radius ? sqrt(1.f - radius*radius/(distance*distance)) : -1.f;
+    }
+    inline bool contains(const Vec3Df & direction) const {
+        return Vec3Df::dotProduct(direction, axis) >= cosMax;
+    }
+    inline float getSolidAngle() const {
+        return 2*M_PI*(1.f - cosMax);
+    }
+};
+
+PhotonMapping::PhotonMapping(Controller *c) :
+    c(c),
+    nbPhotons(200000),
+    nbCausticPhotons(100000),
+    nbNearest(100),
+    maxRadius(0.05f),
+    built(false)
+{}
+
+void PhotonMapping::clear() {
+    lock_guard<std::mutex> lock(mutex);
+    globalMap.clear();
+    causticMap.clear();
+    built = false;
+}
+
+bool PhotonMapping::isBuilt() const {
+    lock_guard<std::mutex> lock(mutex);
+    return built;
+}
+
+void PhotonMapping::build() {
+    lock_guard<std::mutex> lock(mutex);
+    if(built)
+        return;
+    globalMap.clear();
+    causticMap.clear();
+    const Scene *scene = c->getScene();
+    vector<const Light *> lights;
+    float totalIntensity = 0.f;
+    for(const Light *light : scene->getLights()) {
+        if(light->isEnabled()) {
+            lights.push_back(light);
+            totalIntensity += light->getIntensity();
+        }
+    }
+    // Caustics are light focused by these
+    vector<const Object *> specularObjects;
+    for(const Object *o : scene->getObjects()) {
+        const Material & mat = o->getMaterial();
+        if(dynamic_cast<const Glass *>(&mat) || mat.isGlossy())
+            specularObjects.push_back(o);
+    }
+    if(lights.empty() || totalIntensity <= 0.f) {
+        built = true;
+        return;
+    }
+
+    // Lights are picked in proportion to their intensity, photons carry the same power
+    auto pickLight = [&](minstd_rand & random) -> const Light & {
+        float r = uniformRandom(random)*totalIntensity;
+        for(const Light *light : lights) {
+            r -= light->getIntensity();
+            if(r <= 0.f)
+                return *light;
+        }
+        return *lights.back();
+    };
+    const float lightPower = 4*M_PI*totalIntensity/lights.size();
+
+    #pragma omp parallel
+    {
+        // rand() shares its state among the threads
+        minstd_rand random(hash<thread::id>()(this_thread::get_id()));
+        vector<PhotonMap::Photon> globalPhotons, causticPhotons;
+
+        #pragma omp for schedule(dynamic, 256)
+        for(unsigned i = 0; i < nbPhotons; i++) {
+            const Light & light = pickLight(random);
+            const Vec3Df direction = getDirection(Vec3Df(0, 0, 1), 2*uniformRandom(random) - 1, 2*M_PI*uniformRandom(random));
+            trace(getEmissionPoint(light, random), direction, lightPower*light.getColor()/nbPhotons,
+                  false, globalPhotons, causticPhotons, random);
+        }
+
+        // Directions toward the specular objects, weighted by how many of them cover each one
+        #pragma omp for schedule(dynamic, 256)
+        for(unsigned i = 0; i < (specularObjects.empty() ? 0 : nbCausticPhotons); i++) {
+            const Light & light = pickLight(random);
+            const Vec3Df origin = getEmissionPoint(light, random);
+            vector<Cone> cones;
+            for(const Object *o : specularObjects)
+                cones.push_back(Cone(origin, o->getWorldBoundingBox()));
+            const Cone & cone = cones[uniform_int_distribution<unsigned>(0, cones.size() - 1)(random)];
+            const Vec3Df direction = getDirection(cone.axis, 1.f - uniformRandom(random)*(1.f - cone.cosMax), 2*M_PI*uniformRandom(random));
+            float density = 0.f;
+            for(const Cone & k : cones)
+                if(k.contains(direction))
+                    density += 1.f/(cones.size()*k.getSolidAngle());
+            const float share = 1.f/(4*M_PI*density);
+            trace(origin, direction, share*lightPower*light.getColor()/nbCausticPhotons,
+                  true, globalPhotons, causticPhotons, random);
+        }
+
+        #pragma omp critical
+        {
+            globalMap.add(globalPhotons);
+            causticMap.add(causticPhotons);
+        }
+    }
+
+    globalMap.build();
+    causticMap.build();
+    built = true;
+}
+
+Vec3Df PhotonMapping::getEmissionPoint(const Light & light, minstd_rand & random) {
+    if(light.getRadius() <= 0.f || light.getNormal().getSquaredLength() == 0.f)
+        return light.getPos();
+    Vec3Df normal = light.getNormal();
+    normal.normalize();
+    return light.getPos() + light.getRadius()*sqrt(uniformRandom(random))*getDirection(normal, 0.f, 2*M_PI*uniformRandom(random));
+}
+
+void PhotonMapping::trace(Vec3Df origin, Vec3Df direction, Vec3Df power, bool isCausticPass,
+                          vector<PhotonMap::Photon> & globalPhotons,
+                          vector<PhotonMap::Photon> & causticPhotons,
+                          minstd_rand & random) const {
+    const RayTracer *rayTracer = c->getRayTracer();
+    bool isSpecular = false;
+    bool isDiffuse = false;
+
+    for(unsigned bounce = 0; bounce < MAX_BOUNCES; bounce++) {
+        Ray ray;
+        if(!rayTracer->intersect(direction, origin, ray))
+            return;
+        const Material & mat = ray.getIntersectedObject()->getMaterial();
+        const Glass *glass = dynamic_cast<const Glass *>(&mat);
+        const float u = uniformRandom(random);
+
+        // Glass lets alpha of the light through, mirrors reflect glossyRatio of it
+        if(glass && u < glass->getAlpha()) {
+            if(!crossGlass(ray, origin, direction))
+                return;
+            isSpecular = true;
+            continue;
+        }
+        if(!glass && u < mat.getGlossyRatio()) {
+            origin = ray.getIntersection().getPos();
+            direction = direction.reflect(mat.getNormalTexture()->getNormal(&ray));
+            direction.normalize();
+            isSpecular = true;
+            continue;
+        }
+
+        const Vertex hit = ray.getIntersection();
+        const PhotonMap::Photon photon = {hit.getPos(), direction, power, 0};
+        if(isCausticPass) {
+            if(isSpecular)
+                causticPhotons.push_back(photon);
+            return;
+        }
+        // Direct light is shaded, light through specular objects only is in the caustic map
+        if(isDiffuse)
+            globalPhotons.push_back(photon);
+
+        // Russian roulette, surviving photons keep the mean power
+        const Vec3Df reflectance = mat.getDiffuse()*mat.getColorTexture()->getColor(&ray);
+        const float survival = min(1.f, (reflectance[0] + reflectance[1] + reflectance[2])/3);
+        if(uniformRandom(random) >= survival)
+            return;
+        power = power*reflectance/survival;
+        origin = hit.getPos();
+        direction = getDirection(hit.getNormal(), sqrt(uniformRandom(random)), 2*M_PI*uniformRandom(random));
+        isDiffuse = true;
+    }
+}
+
+bool PhotonMapping::crossGlass(Ray & ray, Vec3Df & origin, Vec3Df & direction) const {
+    // As Glass::genColor, which works well only for convex objects
+    Object *o = ray.getIntersectedObject();
+    const Glass & glass = static_cast<const Glass &>(o->getMaterial());
+    const float size = o->getWorldBoundingBox().getRadius();
+    const Vec3Df pos = ray.getIntersection().getPos();
+
+    Vec3Df inside = (-direction).refract(1.f, glass.getNormalTexture()->getNormal(&ray), glass.getCoeff());
+    inside.normalize();
+    Ray exit = o->getObjectRay(pos + 3*size*inside, -inside, ray.getTime());
+    if(!o->getKDtree().intersect(exit)) {
+        origin = pos;
+        return true;
+    }
+    exit.setObjectSpace(o, -inside);
+    Vec3Df out = (-inside).refract(glass.getCoeff(), -glass.getNormalTexture()->getNormal(&exit), 1.f);
+    // Total internal reflection
+    if(out.getSquaredLength() == 0.f)
+        return false;
+    out.normalize();
+    origin = exit.getIntersection().getPos();
+    direction = out;
+    return true;
+}
+
+Vec3Df PhotonMapping::getIrradiance(const PhotonMap & map, const Vertex & intersection) const {
+    if(!map.getNbPhotons())
+        return Vec3Df();
+    const float radius = maxRadius*c->getScene()->getBoundingBox().getRadius();
+    return map.getIrradiance(intersection.getPos(), intersection.getNormal(), nbNearest, radius);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <random>
+
+#include "Vec3D.h"
+#include "Vertex.h"
+#include "PhotonMap.h"
+
+class Controller;
+class Light;
+class Ray;
+
+/**
+ * Photons shot from the lights of the scene, for the PHOTON_MAPPING_MODE of RayTracer
+ * Light reaching a diffuse surface through glass or mirrors only is in the caustic map,
+ * light which bounced on a diffuse surface is in the global one, direct light is in none
+ *
+ * Each light emits 4*pi*intensity, shared among the lights,
+ * so that it gives the irradiance the Brdf uses one unit away
+ */
+class PhotonMapping {
+public:
+    /** Photons bounce until absorbed or this many times */
+    static const unsigned MAX_BOUNCES = 8;
+
+    PhotonMapping(Controller *c);
+
+    /** Shoot the photons of both maps in parallel, unless they already are */
+    void build();
+    /** No render may read the maps meanwhile */
+    void clear();
+    bool isBuilt() const;
+
+    /** Photons shot in the whole scene, for the global map */
+    unsigned getNbPhotons() const {return nbPhotons;}
+    void setNbPhotons(unsigned n) {nbPhotons = n; clear();}
+    /** Photons shot at mirrors and glass, for the caustic map */
+    unsigned getNbCausticPhotons() const {return nbCausticPhotons;}
+    void setNbCausticPhotons(unsigned n) {nbCausticPhotons = n; clear();}
+    /** Photons of a density estimation */
+    unsigned getNbNearest() const {return nbNearest;}
+    void setNbNearest(unsigned n) {nbNearest = n;}
+    /** Largest radius of a density estimation, relative to the scene */
+    float getMaxRadius() const {return maxRadius;}
+    void setMaxRadius(float r) {maxRadius = r;}
+
+    const PhotonMap & getGlobalMap() const {return globalMap;}
+    const PhotonMap & getCausticMap() const {return causticMap;}
+
+    /** Irradiance of the photons of a map reaching intersection */
+    Vec3Df getIrradiance(const PhotonMap & map, const Vertex & intersection) const;
+
+private:
+    Controller *c;
+    unsigned nbPhotons;
+    unsigned nbCausticPhotons;
+    unsigned nbNearest;
+    float maxRadius;
+    /** Guards built, renders started together build once */
+    mutable std::mutex mutex;
+    bool built;
+    PhotonMap globalMap;
+    PhotonMap causticMap;
+
+    /** Random point of the light, which may be a disc */
+    static Vec3Df getEmissionPoint(const Light & light, std::minstd_rand & random);
+
+    /**
+     * Follow a photon until it is absorbed, storing it where it meets diffuse surfaces
+     * Photons of the caustic pass stop at the first diffuse surface
+     */
+    void trace(Vec3Df origin, Vec3Df direction, Vec3Df power, bool isCausticPass,
+               std::vector<PhotonMap::Photon> & globalPhotons,
+               std::vector<PhotonMap::Photon> & causticPhotons,
+               std::minstd_rand & random) const;
+
+    /** Move a photon hitting glass to where it leaves it, false if it does not */
+    bool crossGlass(Ray & ray, Vec3Df & origin, Vec3Df & direction) const;
+};
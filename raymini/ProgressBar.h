@@ -1,32 +1,30 @@
 #pragma once
 
-#include <QObject>
-#include <chrono>
-#include <omp.h>
-#include <iostream>
+#include <atomic>
 
-class Controller;
+/**
+ * Progress of a render, workers only count their iterations
+ * The GUI thread polls it while rendering, nothing is emitted from the workers
+ */
+class ProgressBar {
+public:
+    ProgressBar(): max(0), current(0) {}
 
-class ProgressBar: public QObject {
-    Q_OBJECT
-private:
-    Controller *controller;
-    unsigned max;
-    unsigned current;
-    omp_lock_t lck;
-    std::chrono::time_point<std::chrono::system_clock> start;
-    float lastPercent;
-    std::chrono::time_point<std::chrono::system_clock> lastNow;
+    /** Start over for nbIter iterations */
+    void start(unsigned nbIter) {
+        current.store(0, std::memory_order_relaxed);
+        max.store(nbIter, std::memory_order_relaxed);
+    }
 
-    void lock() { omp_set_lock(&lck); }
-    void unlock() { omp_unset_lock(&lck); }
+    /** One more iteration done, lock free */
+    void operator()() {current.fetch_add(1, std::memory_order_relaxed);}
 
-public:
-    ProgressBar(Controller *, unsigned nbIter);
-    virtual ~ProgressBar();
+    float getPercent() const {
+        const unsigned m = max.load(std::memory_order_relaxed);
+        return m ? 100.f*current.load(std::memory_order_relaxed)/m : 100.f;
+    }
 
-    void operator()();
-
-signals:
-    void updatedPercent(float);
+private:
+    std::atomic<unsigned> max;
+    std::atomic<unsigned> current;
 };
@@ -8,64 +8,10 @@
 #include <GL/glew.h>
 
 #include "Ray.h"
+#include "Object.h"
 
 using namespace std;
 
-static const unsigned int NUMDIM = 3, RIGHT = 0, LEFT = 1, MIDDLE = 2;
-
-bool Ray::intersect (const BoundingBox & bbox, Vec3Df & intersectionPoint) const {
-    const Vec3Df & minBb = bbox.getMin ();
-    const Vec3Df & maxBb = bbox.getMax ();
-    bool inside = true;
-    unsigned int  quadrant[NUMDIM];
-    register unsigned int i;
-    unsigned int whichPlane;
-    Vec3Df maxT;
-    Vec3Df candidatePlane;
-
-    for (i=0; i<NUMDIM; i++)
-        if (origin[i] < minBb[i]) {
-            quadrant[i] = LEFT;
-            candidatePlane[i] = minBb[i];
-            inside = false;
-        } else if (origin[i] > maxBb[i]) {
-            quadrant[i] = RIGHT;
-            candidatePlane[i] = maxBb[i];
-            inside = false;
-        } else	{
-            quadrant[i] = MIDDLE;
-        }
-
-    if (inside)	{
-        intersectionPoint = origin;
-        return (true);
-    }
-
-    for (i = 0; i < NUMDIM; i++)
-        if (quadrant[i] != MIDDLE && direction[i] !=0.)
-            maxT[i] = (candidatePlane[i]-origin[i]) / direction[i];
-        else
-            maxT[i] = -1.;
-
-    whichPlane = 0;
-    for (i = 1; i < NUMDIM; i++)
-        if (maxT[whichPlane] < maxT[i])
-            whichPlane = i;
-
-    if (maxT[whichPlane] < 0.) return (false);
-    for (i = 0; i < NUMDIM; i++)
-        if (whichPlane != i) {
-            intersectionPoint[i] = origin[i] + maxT[whichPlane] *direction[i];
-            if (intersectionPoint[i] < minBb[i] - BBOX_INTERSEC_DELTA ||
-                intersectionPoint[i] > maxBb[i] + BBOX_INTERSEC_DELTA)
-                return (false);
-        } else {
-            intersectionPoint[i] = candidatePlane[i];
-        }
-    return (true);
-}
-
-
 bool Ray::intersect(const Triangle &t, const Vertex & v1, const Vertex & v2, const Vertex & v3, Object *o) {
     Vec3Df vecU = v1.getPos() - v3.getPos();
     Vec3Df vecV = v2.getPos() - v3.getPos();
@@ -113,6 +59,18 @@ bool Ray::intersect(const Triangle &t, const Vertex & v1, const Vertex & v2, con
     return true;
 }
 
+Vertex Ray::getIntersection() {
+    if(!isComputed) {
+        if(isObjectSpace)
+            computedIntersection = {intersectedObject->toWorld(intersection, time),
+                                    intersectedObject->normalToWorld(computeNormal())};
+        else
+            computedIntersection = {intersection, computeNormal()};
+        isComputed = true;
+    }
+    return computedIntersection;
+}
+
 Vec3Df Ray::computeNormal() const {
     if(!hasIntersection) return Vec3Df();
 
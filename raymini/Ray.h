@@ -10,6 +10,9 @@
 
 #include <iostream>
 #include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
 
 #include "Vec3D.h"
 #include "BoundingBox.h"
@@ -20,32 +23,61 @@ class Object;
 
 class Ray {
 public:
-    inline Ray () : hasIntersection(false) , intersectionDistance(1000000.f){}
-    inline Ray (const Vec3Df & origin, const Vec3Df & direction)
+    inline Ray () : negative {false, false, false}, time(0.f), hasIntersection(false) , intersectionDistance(1000000.f), isObjectSpace(false) {}
+    inline Ray (const Vec3Df & origin, const Vec3Df & direction, float time = 0.f)
         : origin (origin), direction (direction),
-          hasIntersection(false) , intersectionDistance(1000000.f),
-          isComputed(false) {}
+          invDirection (1.f/direction[0], 1.f/direction[1], 1.f/direction[2]),
+          negative {std::signbit(direction[0]), std::signbit(direction[1]), std::signbit(direction[2])},
+          time(time), hasIntersection(false) , intersectionDistance(1000000.f),
+          isComputed(false), isObjectSpace(false) {}
     inline virtual ~Ray () {}
 
     inline const Vec3Df & getOrigin () const { return origin; }
     inline Vec3Df & getOrigin () { return origin; }
     inline const Vec3Df & getDirection () const { return direction; }
-    inline Vec3Df & getDirection () { return direction; }
-    inline Vertex getIntersection() {
-        if(!isComputed) {
-            computedIntersection = {intersection+trans, computeNormal()};
-            isComputed = true;
-        }
-        return computedIntersection;
-    }
+    /** Inverse of the direction on each axis, infinite when parallel to it */
+    inline const Vec3Df & getInvDirection () const { return invDirection; }
+    /** Whether the direction goes toward negatives on an axis, -0 does */
+    inline bool isNegative (unsigned axis) const { return negative[axis]; }
+    /** In [0, 1], mobile objects are met where they are at this time of their motion */
+    inline float getTime () const { return time; }
+    inline void setTime (float t) { time = t; }
+    /** In world space once setObjectSpace was called */
+    Vertex getIntersection();
     inline float getIntersectionDistance() const { return intersectionDistance; }
     inline bool intersect() const { return hasIntersection; }
 
-    void translate(const Vec3Df & trans) {
-        this->trans = trans;
+    /**
+     * The ray was given by o->getObjectRay(origin, worldDirection, time) and hit o
+     * Its distance and intersection are now the world ones
+     */
+    inline void setObjectSpace(Object *o, const Vec3Df & worldDirection) {
+        intersectedObject = o;
+        intersectionDistance *= worldDirection.getSquaredLength()/direction.getSquaredLength();
+        isObjectSpace = true;
+        isComputed = false;
     }
 
-    bool intersect (const BoundingBox & bbox, Vec3Df & intersectionPoint) const;
+    /**
+     * Slab test, entry and exit parameters along the ray in tMin and tMax
+     * The box is only searched in front of the origin
+     */
+    inline bool intersect (const BoundingBox & bbox, float & tMin, float & tMax) const {
+        tMin = 0.f;
+        tMax = std::numeric_limits<float>::max();
+        return clip(bbox, tMin, tMax);
+    }
+    /** Restrict [tMin, tMax] to the box, false if nothing remains */
+    inline bool clip (const BoundingBox & bbox, float & tMin, float & tMax) const {
+        for (unsigned int i = 0; i < 3; i++) {
+            const float tNear = ((negative[i] ? bbox.getMax() : bbox.getMin())[i] - origin[i]) * invDirection[i];
+            const float tFar = ((negative[i] ? bbox.getMin() : bbox.getMax())[i] - origin[i]) * invDirection[i];
+            // NaN, when parallel on a slab side, is dropped by min and max
+            tMin = std::max(tMin, tNear);
+            tMax = std::min(tMax, tFar);
+        }
+        return tMin <= tMax;
+    }
     bool intersect (const Triangle &t, const Vertex & v1, const Vertex & v2, const Vertex & v3, Object *o);
     bool intersectDisc(const Vec3Df & center, const Vec3Df & normal, float radius) ;
 
@@ -66,9 +98,11 @@ public:
     Object *getIntersectedObject() const {return intersectedObject;}
 
 private:
-    static constexpr float BBOX_INTERSEC_DELTA = 0.1f;
     Vec3Df origin;
     Vec3Df direction;
+    Vec3Df invDirection;
+    bool negative[3];
+    float time;
 
     bool hasIntersection;
     Vec3Df intersection;
@@ -76,7 +110,7 @@ private:
 
     bool isComputed;
     Vertex computedIntersection;
-    Vec3Df trans;
+    bool isObjectSpace;
     const Vertex *a, *b, *c;
     const Triangle *t;
     Vec3Df computeNormal() const;
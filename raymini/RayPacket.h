@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Vec3D.h"
+#include "Ray.h"
+
+/**
+ * Neighbouring rays traced together through the hierarchies
+ * Each ray keeps its own closest intersection
+ */
+class RayPacket {
+public:
+    static const unsigned SIZE = 4;
+
+    RayPacket() {}
+    RayPacket(const Vec3Df & origin, const Vec3Df directions[SIZE]) {
+        for(unsigned i = 0 ; i < SIZE ; i++)
+            rays[i] = Ray(origin, directions[i]);
+    }
+
+    inline Ray & operator[](unsigned i) { return rays[i]; }
+    inline const Ray & operator[](unsigned i) const { return rays[i]; }
+
+    /** Directions share their signs on every axis, needed to cross KDtrees together */
+    bool isCoherent() const {
+        for(unsigned axis = 0 ; axis < 3 ; axis++) {
+            bool negative = rays[0].isNegative(axis);
+            for(unsigned i = 1 ; i < SIZE ; i++)
+                if(rays[i].isNegative(axis) != negative)
+                    return false;
+        }
+        return true;
+    }
+
+private:
+    Ray rays[SIZE];
+};
@@ -8,21 +8,26 @@
 #include <QImage>
 #include <iostream>
 #include <algorithm>
+#include <omp.h>
+#include <random>
+#include <thread>
 
 #include "Controller.h"
 #include "ProgressBar.h"
 #include "RayTracer.h"
 #include "Ray.h"
+#include "RayPacket.h"
+#include "TileScheduler.h"
 #include "Scene.h"
 #include "Color.h"
 #include "Brdf.h"
 
 using namespace std;
 
-inline int clamp (float f) {
-    int v = static_cast<int> (255*f);
-    return min(max(v, 0), 255);
-}
+/** Time of the sample each thread traces, see setSampleTime */
+static thread_local float sampleTime = 0.f;
+/** Jitter of sampleTime, each thread has its own */
+static thread_local minstd_rand timeJitter(hash<thread::id>()(this_thread::get_id()));
 
 RayTracer::RayTracer(Controller *c):
     mode(Mode::PATH_TRACING_MODE),
@@ -39,6 +44,9 @@ RayTracer::RayTracer(Controller *c):
     durtiestQuality(ONE_OVER_X),
     backgroundColor(Vec3Df(.1f, .1f, .3f)),
     shadow(this),
+    irradianceCaching(false),
+    photonMapping(c),
+    threadPool(omp_get_max_threads()),
     controller(c)
 {}
 
@@ -49,28 +57,31 @@ QImage RayTracer::RayTracer::render (const Vec3Df & camPos,
                                      float fieldOfView,
                                      float aspectRatio,
                                      unsigned int screenWidth,
-                                     unsigned int screenHeight) const {
+                                     unsigned int screenHeight,
+                                     FrameBuffer & frameBuffer,
+                                     ProgressBar & progressBar) const {
     const Scene *scene = controller->getScene();
     int qualityDivider = quality==ONE_OVER_X?this->qualityDivider:1;
     // To avoid black pixels on the top of the screen
     unsigned int computedScreenWidth = ceil((float)screenWidth/(float)qualityDivider);
     unsigned int computedScreenHeight = ceil((float)screenHeight/(float)qualityDivider);
  
-    static vector<Color> buffer;
-    buffer.resize(computedScreenHeight*computedScreenWidth);
+    // Pixels of a cancelled frame keep their last color
+    frameBuffer.resize(computedScreenWidth, computedScreenHeight);
 
     bool raf_PT = quality == OPTIMAL && depthPathTracing && controller->getWindowModel()->isRealTime();
 
-    if(!raf_PT)
-        buffer.clear();
-
     vector<pair<float, float>> singleNulOffset;
     singleNulOffset.push_back(pair<float, float>(0, 0));
 
     int nbRay = max(nbRayAntiAliasing, (depthPathTracing) ? nbRayPathTracing : 0);
     nbRay = (raf_PT) ? 1 : nbRay;
-    const vector<pair<float, float>> offsets =  (quality==OPTIMAL) ?
-                                                AntiAliasing::generateOffsets(typeAntiAliasing, nbRay) : singleNulOffset;
+    vector<pair<float, float>> offsets =  (quality==OPTIMAL) ?
+                                          AntiAliasing::generateOffsets(typeAntiAliasing, nbRay) : singleNulOffset;
+    // Motion blur takes at least nbPictures samples per pixel, each one at its own time
+    const unsigned nbTimes = scene->hasMobile()&&quality==OPTIMAL?nbPictures:1;
+    for (unsigned int s = offsets.size(), n = offsets.size(); s < nbTimes; s++)
+        offsets.push_back(offsets[s%n]);
     const vector<pair<float, float>> offsets_focus = Focus::generateOffsets(typeFocus, apertureFocus, nbRayFocus);
 
     const float tang = tan (fieldOfView);
@@ -80,42 +91,46 @@ QImage RayTracer::RayTracer::render (const Vec3Df & camPos,
     const Vec3Df camToObject = controller->getWindowModel()->getFocusPoint().getPos() - camPos;
     const float focalDistance = Vec3Df::dotProduct(camToObject, direction) - distanceOrthogonalCameraScreen;
 
-    const unsigned nbIterations = scene->hasMobile()&&quality==OPTIMAL?nbPictures:1;
-    ProgressBar progressBar(controller, nbIterations*computedScreenWidth);
-
-    // For each picture
-    for (unsigned picNumber = 0 ; picNumber < nbIterations; picNumber++) {
-
-        // For each pixel
-        #pragma omp parallel for
-        for (unsigned int i = 0; i < computedScreenWidth; i++) {
-            progressBar();
-            for (unsigned int j = 0; j < computedScreenHeight && !controller->getRenderThread()->isEmergencyStop(); j++) {
-                buffer[j*computedScreenWidth+i] += computePixel(camPos,
-                                                                direction,
-                                                                upVec, rightVec,
-                                                                computedScreenWidth, computedScreenHeight,
-                                                                offsets, offsets_focus,
-                                                                focalDistance,
-                                                                i, j);
+    if(mode == PHOTON_MAPPING_MODE && quality == OPTIMAL)
+        photonMapping.build();
+
+    // Tiles are taken in Morton order, threads done early steal from the others
+    TileScheduler scheduler(computedScreenWidth, computedScreenHeight, threadPool.getNbThreads());
+    progressBar.start(scheduler.getNbTiles());
+
+    threadPool.run([&](unsigned thread) {
+        TileScheduler::Tile tile;
+        while (!isCancelled() && scheduler.next(thread, tile)) {
+            // For each packet of pixels of the tile, traced together
+            for (unsigned int j = tile.y; j < tile.y+tile.height; j += TILE_HEIGHT) {
+                for (unsigned int i = tile.x; i < tile.x+tile.width; i += TILE_WIDTH) {
+                    Vec3Df colors[RayPacket::SIZE];
+                    // A packet cut short would darken its pixels
+                    if (!computeTile(camPos,
+                                     direction,
+                                     upVec, rightVec,
+                                     computedScreenWidth, computedScreenHeight,
+                                     offsets, offsets_focus,
+                                     focalDistance,
+                                     i, j, colors))
+                        return;
+                    for (unsigned int k = 0; k < RayPacket::SIZE; k++) {
+                        unsigned int x = i + k%TILE_WIDTH;
+                        unsigned int y = j + k/TILE_WIDTH;
+                        if (x < tile.x+tile.width && y < tile.y+tile.height) {
+                            if (raf_PT)
+                                frameBuffer.add(x, y, colors[k]);
+                            else
+                                frameBuffer.set(x, y, colors[k]);
+                        }
+                    }
+                }
             }
+            progressBar();
         }
-        controller->setSceneMove(nbPictures);
-    }
+    });
 
-    QImage image (QSize (screenWidth, screenHeight), QImage::Format_RGB888);
-    for (unsigned int i = 0; i < screenWidth; i++) {
-        unsigned int computedI = i/qualityDivider;
-        for (unsigned int j = 0; j < screenHeight; j++) {
-            unsigned int computedJ = j/qualityDivider;
-            Color c = buffer[computedJ*computedScreenWidth+computedI];
-            image.setPixel(i, j, qRgb(clamp(c[0]), clamp(c[1]), clamp(c[2])));
-        }
-    }
-
-    controller->setSceneReset();
-
-    return image;
+    return frameBuffer.toImage(screenWidth, screenHeight, qualityDivider);
 }
 
 Vec3Df RayTracer::computePixel(const Vec3Df & camPos,
@@ -131,7 +146,9 @@ Vec3Df RayTracer::computePixel(const Vec3Df & camPos,
     Color c;
 
     // For each ray in each pixel
-    for (const pair<float, float> &offset : offsets) {
+    for (unsigned int s = 0; s < offsets.size() && !isCancelled(); s++) {
+        const pair<float, float> &offset = offsets[s];
+        setSampleTime(s, offsets.size());
         Vec3Df stepX = (float(i)+offset.first - screenWidth/2.f) * rightVec;
         Vec3Df stepY = (float(j)+offset.second - screenHeight/2.f) * upVec;
         Vec3Df step = stepX + stepY;
@@ -157,30 +174,103 @@ Vec3Df RayTracer::computePixel(const Vec3Df & camPos,
     return c();
 }
 
+bool RayTracer::computeTile(const Vec3Df & camPos,
+                            const Vec3Df & direction,
+                            const Vec3Df & upVec,
+                            const Vec3Df & rightVec,
+                            unsigned int screenWidth,
+                            unsigned int screenHeight,
+                            const vector<pair<float, float>> &offsets,
+                            const vector<pair<float, float>> &offsets_focus,
+                            float focalDistance,
+                            unsigned i, unsigned j,
+                            Vec3Df colors[RayPacket::SIZE]) const {
+    // Depth of field rays do not share their origin
+    if (typeFocus != Focus::NONE && quality == OPTIMAL) {
+        for (unsigned int k = 0; k < RayPacket::SIZE; k++)
+            colors[k] = computePixel(camPos, direction, upVec, rightVec,
+                                     screenWidth, screenHeight,
+                                     offsets, offsets_focus, focalDistance,
+                                     i + k%TILE_WIDTH, j + k/TILE_WIDTH);
+        return !isCancelled();
+    }
+
+    Color c[RayPacket::SIZE];
+    Brdf::Type type = onlyAmbientOcclusion?Brdf::Ambient:Brdf::All;
+
+    // For each ray in each pixel
+    for (unsigned int s = 0; s < offsets.size(); s++) {
+        if (isCancelled())
+            return false;
+        const pair<float, float> &offset = offsets[s];
+        setSampleTime(s, offsets.size());
+        Vec3Df dirs[RayPacket::SIZE];
+        for (unsigned int k = 0; k < RayPacket::SIZE; k++) {
+            Vec3Df stepX = (float(i + k%TILE_WIDTH)+offset.first - screenWidth/2.f) * rightVec;
+            Vec3Df stepY = (float(j + k/TILE_WIDTH)+offset.second - screenHeight/2.f) * upVec;
+            dirs[k] = direction + stepX + stepY;
+            dirs[k].normalize();
+        }
+
+        RayPacket bestRays;
+        intersect(dirs, camPos, bestRays);
+        for (unsigned int k = 0; k < RayPacket::SIZE; k++) {
+            if (bestRays[k].intersect())
+                c[k] += shade(camPos, bestRays[k], 0, type);
+            else
+                c[k] += backgroundColor;
+        }
+    }
+
+    for (unsigned int k = 0; k < RayPacket::SIZE; k++)
+        colors[k] = c[k]();
+    return true;
+}
+
 bool RayTracer::intersect(const Vec3Df & dir,
                           const Vec3Df & camPos,
                           Ray & bestRay) const {
     const Scene * scene = controller->getScene();
     bestRay = Ray();
+    bestRay.setTime(sampleTime);
 
+    scene->getBVH().intersect(camPos + DISTANCE_MIN_INTERSECT*dir, dir, bestRay);
 
-    for (Object * o : scene->getObjects()) {
-        if (!o->isEnabled()) {
-            continue;
-        }
-        Ray ray (camPos - o->getTrans ()+ DISTANCE_MIN_INTERSECT*dir, dir);
+    return bestRay.intersect();
+}
 
-        if (o->getKDtree().intersect(ray) &&
-            ray.getIntersectionDistance() < bestRay.getIntersectionDistance()) {
-            bestRay = ray;
-        }
-    }
+void RayTracer::intersect(const Vec3Df dirs[RayPacket::SIZE],
+                          const Vec3Df & camPos,
+                          RayPacket & bestRays) const {
+    const Scene * scene = controller->getScene();
+    for (unsigned int k = 0; k < RayPacket::SIZE; k++)
+        bestRays[k] = Ray(camPos + DISTANCE_MIN_INTERSECT*dirs[k], dirs[k], sampleTime);
 
-    if(bestRay.intersect()) {
-        bestRay.translate(bestRay.getIntersectedObject()->getTrans());
-    }
+    scene->getBVH().intersect(bestRays);
+}
 
-    return bestRay.intersect();
+static bool isGlass(const Object *o) {
+    return dynamic_cast<const Glass *>(&o->getMaterial());
+}
+
+bool RayTracer::occlude(const Vec3Df & dir,
+                        const Vec3Df & pos,
+                        float maxDistance,
+                        bool throughGlass) const {
+    const Scene * scene = controller->getScene();
+    const float length = dir.getLength();
+    const float maxT = (maxDistance - DISTANCE_MIN_INTERSECT*length)/length;
+
+    return scene->getBVH().occlude(pos + DISTANCE_MIN_INTERSECT*dir, dir, maxT, sampleTime,
+                                   throughGlass ? isGlass : nullptr);
+}
+
+void RayTracer::setSampleTime(unsigned int sample, unsigned int nbSamples) const {
+    // Stratified, each sample gets its share of the motion
+    if (quality == OPTIMAL && nbPictures > 1)
+        sampleTime = (sample + uniform_real_distribution<float>()(timeJitter))/nbSamples;
+    else
+        sampleTime = 0.f;
 }
 
 Vec3Df RayTracer::getColor(const Vec3Df & dir, const Vec3Df & camPos, bool pathTracing) const {
@@ -191,12 +281,14 @@ Vec3Df RayTracer::getColor(const Vec3Df & dir, const Vec3Df & camPos, bool pathT
 }
 
 Vec3Df RayTracer::getColor(const Vec3Df & dir, const Vec3Df & camPos, Ray & bestRay, unsigned depth, Brdf::Type type) const {
-
-
     if(!intersect(dir, camPos, bestRay)) {
         return backgroundColor;
     }
 
+    return shade(camPos, bestRay, depth, type);
+}
+
+Vec3Df RayTracer::shade(const Vec3Df & camPos, Ray & bestRay, unsigned depth, Brdf::Type type) const {
     // hit something
     const Material & mat = bestRay.getIntersectedObject()->getMaterial();
     const vector<Light> & lights = getLights(bestRay.getIntersection());
@@ -204,13 +296,42 @@ Vec3Df RayTracer::getColor(const Vec3Df & dir, const Vec3Df & camPos, Ray & best
     Color color = mat.genColor(camPos, &bestRay, lights, type);
 
     if(mode == PBGI_MODE && quality == OPTIMAL) {
-        vector<Light> lights_pbgi = controller->getPBGI()->getLights(bestRay);
-        color += mat.genColor(camPos, &bestRay, lights_pbgi, Brdf::Diffuse);
+        const PBGI * pbgi = controller->getPBGI();
+        const Vec3Df diffuse = mat.getDiffuse()*mat.getColorTexture()->getColor(&bestRay);
+        // The cache gathers by ray casting, a micro-buffer gathers at every pixel
+        if(pbgi->getGather() == PBGI::MICRO_BUFFER)
+            color += diffuse*pbgi->getIrradiance(bestRay);
+        else if(useIrradianceCache())
+            color += diffuse*getIrradiance(bestRay);
+        else {
+            vector<Light> lights_pbgi = pbgi->getLights(bestRay);
+            color += mat.genColor(camPos, &bestRay, lights_pbgi, Brdf::Diffuse);
+        }
+        return color();
+    }
+
+    if(mode == PHOTON_MAPPING_MODE && quality == OPTIMAL) {
+        const Vertex intersection = bestRay.getIntersection();
+        const Vec3Df diffuse = mat.getDiffuse()*mat.getColorTexture()->getColor(&bestRay);
+        Vec3Df irradiance = photonMapping.getIrradiance(photonMapping.getCausticMap(), intersection);
+        // Final gather, the global map is blotchy seen directly
+        if(useIrradianceCache())
+            irradiance += getIrradiance(bestRay);
+        else
+            irradiance += photonMapping.getIrradiance(photonMapping.getGlobalMap(), intersection);
+        // Color averages what is added, indirect light is a single term as in the other modes
+        color += diffuse*irradiance;
         return color();
     }
 
     // PATH TRACING
-    if(depth < depthPathTracing) {
+    if(depth == 0 && depthPathTracing && useIrradianceCache()) {
+        Vec3Df irradiance = getIrradiance(bestRay);
+        color += mat.getColorTexture()->getColor(&bestRay)*irradiance;
+        if(onlyPathTracing)
+            color = irradiance;
+    }
+    else if(depth < depthPathTracing) {
         Vec3Df new_orig = bestRay.getIntersection().getPos();
         Vec3Df new_dir = Vec3Df::getRandomOnHemisphere(bestRay.getIntersection().getNormal());
 
@@ -227,6 +348,74 @@ Vec3Df RayTracer::getColor(const Vec3Df & dir, const Vec3Df & camPos, Ray & best
     return color();
 }
 
+bool RayTracer::isCancelled() const {
+    return controller->getRenderThread()->isEmergencyStop();
+}
+
+bool RayTracer::useIrradianceCache() const {
+    // Records do not follow mobile objects
+    return irradianceCaching && quality == OPTIMAL &&
+        !(nbPictures > 1 && controller->getScene()->hasMobile());
+}
+
+void RayTracer::clearIndirectLight() {
+    irradianceCache.clear(controller->getScene()->getBoundingBox());
+    photonMapping.clear();
+}
+
+Vec3Df RayTracer::getIrradiance(Ray & bestRay) const {
+    const Vertex intersection = bestRay.getIntersection();
+    Vec3Df irradiance;
+    if(irradianceCache.lookup(intersection.getPos(), intersection.getNormal(), irradiance))
+        return irradiance;
+
+    const IrradianceCache::Record record = irradianceCache.gather(
+        intersection.getPos(), intersection.getNormal(),
+        [&](const Vec3Df & dir, float & distance) {
+            return getIndirectRadiance(intersection.getPos(), dir, distance);
+        });
+    irradianceCache.insert(record);
+    return record.irradiance;
+}
+
+Vec3Df RayTracer::getIndirectRadiance(const Vec3Df & pos, const Vec3Df & dir, float & distance) const {
+    if(mode == PBGI_MODE) {
+        const PBGI * pbgi = controller->getPBGI();
+        // Share of the hemisphere of a gathered direction
+        const float maxSolidAngle = pbgi->getCutRatio()*2*M_PI/
+            (IrradianceCache::NB_THETA*IrradianceCache::NB_PHI);
+        // PBGI lights are averaged with their cosine, half the cosine-weighted mean
+        return 0.5f*pbgi->getRadiance(pos, dir, maxSolidAngle, distance);
+    }
+
+    if(mode == PHOTON_MAPPING_MODE) {
+        // Direct light and photons where the gathered ray lands
+        Ray ray;
+        if(!intersect(dir, pos, ray)) {
+            distance = 0.f;
+            return Vec3Df();
+        }
+        distance = sqrt(ray.getIntersectionDistance());
+        const Material & mat = ray.getIntersectedObject()->getMaterial();
+        const Vertex intersection = ray.getIntersection();
+        const Vec3Df diffuse = mat.getDiffuse()*mat.getColorTexture()->getColor(&ray);
+        Color color = mat.genColor(pos, &ray, getLights(intersection), Brdf::Diffuse);
+        color += diffuse*(photonMapping.getIrradiance(photonMapping.getGlobalMap(), intersection) +
+                          photonMapping.getIrradiance(photonMapping.getCausticMap(), intersection));
+        return color();
+    }
+
+    // As a path from shade, without the color of the receiver
+    Ray ray;
+    const Vec3Df color = getColor(dir, pos, ray, 1, Brdf::Diffuse);
+    if(!ray.intersect()) {
+        distance = 0.f;
+        return Vec3Df();
+    }
+    distance = sqrt(ray.getIntersectionDistance());
+    return intensityPathTracing/pow(1.0 + ray.getIntersectionDistance(), 3)*color;
+}
+
 vector<Light> RayTracer::getLights(const Vertex & closestIntersection) const {
     vector<Light *> lights = controller->getScene()->getLights();
     vector<Light> enabledLights;
@@ -253,11 +442,8 @@ float RayTracer::getAmbientOcclusion(Vertex intersection) const {
     for (Vec3Df & direction : directions) {
         const Vec3Df & pos = intersection.getPos();
 
-        Ray bestRay;
-        if (intersect(direction, pos, bestRay)) {
-            if (bestRay.getIntersectionDistance() < radiusAmbientOcclusion) {
-                occlusion++;
-            }
+        if (occlude(direction, pos, radiusAmbientOcclusion, false)) {
+            occlusion++;
         }
     }
 
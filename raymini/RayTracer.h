@@ -22,6 +22,12 @@
 #include "Focus.h"
 #include "Observable.h"
 #include "RenderThread.h"
+#include "RayPacket.h"
+#include "IrradianceCache.h"
+#include "PhotonMapping.h"
+#include "ThreadPool.h"
+#include "FrameBuffer.h"
+#include "ProgressBar.h"
 
 class Color;
 class Vertex;
@@ -52,8 +58,12 @@ public:
     static const unsigned long DURTIEST_QUALITY_DIVIDER_CHANGED = 1<<19;
     static const unsigned long BACKGROUND_CHANGED               = 1<<20;
     static const unsigned long SHADOW_CHANGED                   = 1<<21;
+    static const unsigned long IRRADIANCE_CACHE_CHANGED         = 1<<22;
+    /** Changes after which the indirect light in the IrradianceCache is wrong */
+    static const unsigned long INDIRECT_CHANGED = MODE_CHANGED | DEPTH_PT_CHANGED | INTENSITY_PT_CHANGED |
+                                                  SHADOW_CHANGED | IRRADIANCE_CACHE_CHANGED;
 
-    enum Mode {PATH_TRACING_MODE = 0, PBGI_MODE};
+    enum Mode {PATH_TRACING_MODE = 0, PBGI_MODE, PHOTON_MAPPING_MODE};
     enum Quality {OPTIMAL, BASIC, ONE_OVER_X};
 
     Mode getMode() const {return mode;}
@@ -161,6 +171,7 @@ public:
         setChanged(APERTURE_FOCUS_CHANGED);
     }
 
+    /** Least samples per pixel for motion blur, 1 shows mobile objects still */
     unsigned getNbPictures() const {return nbPictures;}
     /** Change NB_PICTURES_CHANGED */
     void setNbPictures(unsigned n) {
@@ -210,6 +221,22 @@ public:
     }
     unsigned getShadowNbImpulse() const {return shadow.nbImpulse;}
 
+    /**
+     * Whether indirect light at primary hits is interpolated from an IrradianceCache,
+     * at OPTIMAL quality for still pictures, off by default as it approximates the path tracing
+     * PBGI fills it by ray casting, its MICRO_BUFFER gather does not use it
+     */
+    bool isIrradianceCaching() const {return irradianceCaching;}
+    /** Change IRRADIANCE_CACHE_CHANGED */
+    void setIrradianceCaching(bool c) {
+        irradianceCaching = c;
+        setChanged(IRRADIANCE_CACHE_CHANGED);
+    }
+    /** Forget the cached indirect light and the photons, to do once the scene changed, never while rendering */
+    void clearIndirectLight();
+
+    const PhotonMapping & getPhotonMapping() const {return photonMapping;}
+
     const Vec3Df & getBackgroundColor () const { return backgroundColor;}
     /** Change BACKGROUND_CHANGED */
     void setBackgroundColor (const Vec3Df & c) {
@@ -217,6 +244,11 @@ public:
         setChanged(BACKGROUND_CHANGED);
     }
 
+    /**
+     * Samples are written to frameBuffer, accumulated in real-time path tracing
+     * progressBar counts the tiles written
+     * Renders of different frame buffers may run at the same time, their tiles share the ThreadPool
+     */
     QImage render (const Vec3Df & camPos,
                    const Vec3Df & viewDirection,
                    const Vec3Df & upVector,
@@ -224,7 +256,9 @@ public:
                    float fieldOfView,
                    float aspectRatio,
                    unsigned int screenWidth,
-                   unsigned int screenHeight) const;
+                   unsigned int screenHeight,
+                   FrameBuffer & frameBuffer,
+                   ProgressBar & progressBar) const;
 
     inline Vec3Df computePixel(const Vec3Df & camPos,
                                const Vec3Df & direction,
@@ -237,10 +271,40 @@ public:
                                float focalDistance,
                                unsigned i, unsigned j) const;
 
+    /**
+     * Pixels of the tile starting at (i, j), packet traced, row by row in colors
+     * False if the render was cancelled before they were all sampled
+     */
+    bool computeTile(const Vec3Df & camPos,
+                     const Vec3Df & direction,
+                     const Vec3Df & upVec,
+                     const Vec3Df & rightVec,
+                     unsigned int screenWidth,
+                     unsigned int screenHeight,
+                     const std::vector<std::pair<float, float>> &offsets,
+                     const std::vector<std::pair<float, float>> &offsets_focus,
+                     float focalDistance,
+                     unsigned i, unsigned j,
+                     Vec3Df colors[RayPacket::SIZE]) const;
+
     bool intersect(const Vec3Df & dir,
                    const Vec3Df & camPos,
                    Ray & bestRay) const;
 
+    /** Same as intersect for a packet of rays from camPos */
+    void intersect(const Vec3Df dirs[RayPacket::SIZE],
+                   const Vec3Df & camPos,
+                   RayPacket & bestRays) const;
+
+    /**
+     * Whether something lies less than maxDistance away from pos along dir
+     * Stops at the first blocker, Glass objects are ignored if throughGlass
+     */
+    bool occlude(const Vec3Df & dir,
+                 const Vec3Df & pos,
+                 float maxDistance,
+                 bool throughGlass) const;
+
     Vec3Df getColor(const Vec3Df & dir, const Vec3Df & camPos, bool pathTracing = true) const;
     float getAmbientOcclusion(Vertex pos) const;
 
@@ -278,15 +342,40 @@ private:
     Quality durtiestQuality;
     Vec3Df backgroundColor;
     Shadow shadow;
+    bool irradianceCaching;
     /*        End Config         */
 
+    /** Kept over renders, records are added while rendering */
+    mutable IrradianceCache irradianceCache;
+    /** Shot by the first render in PHOTON_MAPPING_MODE */
+    mutable PhotonMapping photonMapping;
+    /** Renders the tiles of every frame */
+    mutable ThreadPool threadPool;
+
     Controller *controller;
 
     static constexpr float DISTANCE_MIN_INTERSECT = 0.000001f;
     static constexpr float distanceOrthogonalCameraScreen = 1.0;
+    /** Pixels of a packet, TileScheduler tiles are made of whole packets */
+    static const unsigned TILE_WIDTH = 2;
+    static const unsigned TILE_HEIGHT = RayPacket::SIZE/TILE_WIDTH;
 
     Vec3Df getColor(const Vec3Df & dir, const Vec3Df & camPos, Ray & bestRay, unsigned depth = 0, Brdf::Type type = Brdf::All) const;
+    /** Color of the intersection of bestRay */
+    Vec3Df shade(const Vec3Df & camPos, Ray & bestRay, unsigned depth, Brdf::Type type) const;
     std::vector<Light> getLights(const Vertex & closestIntersection) const;
+    /** Whether the frame being rendered is stale, checked between tiles and samples */
+    bool isCancelled() const;
+    bool useIrradianceCache() const;
+    /** Indirect light at the intersection of bestRay, from the IrradianceCache or gathered into it */
+    Vec3Df getIrradiance(Ray & bestRay) const;
+    /** Indirect light reaching pos from dir, distance is how far it comes from, 0 if none */
+    Vec3Df getIndirectRadiance(const Vec3Df & pos, const Vec3Df & dir, float & distance) const;
+    /**
+     * Time at which this thread traces sample among nbSamples of a pixel,
+     * rays it sends meanwhile meet mobile objects at this time
+     */
+    void setSampleTime(unsigned int sample, unsigned int nbSamples) const;
 };
 
 
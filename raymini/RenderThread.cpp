@@ -4,7 +4,7 @@
 
 using namespace std;
 
-RenderThread::RenderThread(Controller *c): controller(c), emergencyStop(false) {
+RenderThread::RenderThread(Controller *c): controller(c), emergencyStop(false), haveToRedraw(true) {
     connect(this, SIGNAL(finished()), controller, SLOT(threadRenderRayImage()));
 }
 
@@ -14,9 +14,7 @@ void RenderThread::run() {
         reallyWorkingMutex.lock();
         reallyWorking = true;
         reallyWorkingMutex.unlock();
-        emergencyStopMutex.lock();
-        emergencyStop = false;
-        emergencyStopMutex.unlock();
+        emergencyStop.store(false, memory_order_relaxed);
         time.restart();
         time.start();
         resultImage = controller->getRayTracer()->render(
@@ -27,7 +25,9 @@ void RenderThread::run() {
                 fieldOfView,
                 aspectRatio,
                 screenWidth,
-                screenHeight);
+                screenHeight,
+                frameBuffer,
+                progressBar);
         setChanged(RENDER_CHANGED);
         controller->threadSetElapsed(time.elapsed());
         optimalDone = controller->threadImproveRenderingQuality();
@@ -48,12 +48,8 @@ void RenderThread::startRendering(const Vec3Df & camPos,
                                   unsigned int screenWidth,
                                   unsigned int screenHeight) {
     hasToRedrawMutex.lock();
-    haveToRedraw |= this->camPos != camPos;
-    if (!haveToRedraw) {
-        emergencyStopMutex.lock();
-        haveToRedraw = emergencyStop;
-        emergencyStopMutex.unlock();
-    }
+    if (this->camPos != camPos || emergencyStop.load(memory_order_relaxed))
+        haveToRedraw = true;
     if (haveToRedraw) {
         if (controller->getWindowModel()->isRealTime()) {
             controller->threadSetDurtiestRenderingQuality();
@@ -88,8 +84,8 @@ void RenderThread::setPercent(float p)
 
 void RenderThread::stopRendering() {
     setChanged(RENDER_CHANGED);
-    // Don't use mutexes to be immediate
-    emergencyStop = true;
+    // No mutex, the render holds hasToRedrawMutex until it returns
+    emergencyStop.store(true, memory_order_relaxed);
     haveToRedraw = true;
     quit();
 }
@@ -99,12 +95,7 @@ const QImage &RenderThread::getLastRendered() {
 }
 
 bool RenderThread::isEmergencyStop() const {
-    bool result;
-    //emergencyStopMutex.lock();
-    result = emergencyStop;
-    //emergencyStopMutex.unlock();
-
-    return result;
+    return emergencyStop.load(memory_order_relaxed);
 }
 
 void RenderThread::hasToRedraw() {
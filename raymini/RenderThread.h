@@ -4,9 +4,12 @@
 #include <QImage>
 #include <QTime>
 #include <QMutex>
+#include <atomic>
 
 #include "Vec3D.h"
 #include "Observable.h"
+#include "FrameBuffer.h"
+#include "ProgressBar.h"
 
 class Controller;
 
@@ -32,9 +35,12 @@ public:
     void stopRendering();
     const QImage &getLastRendered();
     inline float getPercent() const {return percent;}
+    /** Counted by the workers of the render */
+    inline const ProgressBar & getProgressBar() const {return progressBar;}
     /** Change RENDER_CHANGED */
     void setPercent(float p);
 
+    /** Lock free, cheap enough for every sample */
     bool isEmergencyStop() const;
 
     /** Notify thread that it has to render again */
@@ -48,6 +54,9 @@ private:
 
     // Result
     QImage resultImage;
+    /** Accumulates samples over the renders of the same view */
+    FrameBuffer frameBuffer;
+    ProgressBar progressBar;
 
     // Params
     Vec3Df camPos;
@@ -61,10 +70,11 @@ private:
     float percent;
 
     // Thread attributes
-    bool emergencyStop;
-    QMutex emergencyStopMutex;
+    /** Set by the GUI thread while rendering, polled by every worker */
+    std::atomic<bool> emergencyStop;
     QTime time;
-    bool haveToRedraw;
+    /** Also set without the mutex by stopRendering, which must not wait for the render */
+    std::atomic<bool> haveToRedraw;
     bool optimalDone;
     QMutex hasToRedrawMutex;
     QMutex reallyWorkingMutex;
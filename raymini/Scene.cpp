@@ -37,7 +37,8 @@ void printUsage(char * name) {
 }
 
 Scene::Scene(Controller *c, int argc, char **argv) :
-    controller(c)
+    controller(c),
+    bvh(objects)
 {
     basicNormal = new MeshNormalTexture();
     normalTextures.push_back(basicNormal);
@@ -117,22 +118,28 @@ Scene::Scene(Controller *c, int argc, char **argv) :
     string id(argc>1?argv[1]:"");
     string meshPath(argc>2?argv[2]:"");
 
-    if(!id.compare("room")) buildRoom();
-    else if(!id.compare("rs")) buildRoom(red);
-    else if(!id.compare("rsm")) buildRoom(mirrorMat);
-    else if(!id.compare("rsglas")) buildRoom(glassMat);
-    else if(!id.compare("rsglos")) buildRoom(glossyMat);
-    else if(!id.compare("lights")) buildMultiLights();
-    else if(!id.compare("meshs")) buildMultiMeshs();
-    else if(!id.compare("outdoor")) buildOutdor();
-    else if(!id.compare("pool")) buildPool();
-    else if(!id.compare("mg")) buildMirrorGlass();
-    else if(!id.compare("sphere")) buildSphere();
-    else if(!id.compare("mesh"))
-        buildMesh(meshPath, grey);
-    else printUsage(argv[0]);
+    // KDtrees of the objects are built by tasks while the builder goes on
+    #pragma omp parallel
+    #pragma omp master
+    {
+        if(!id.compare("room")) buildRoom();
+        else if(!id.compare("rs")) buildRoom(red);
+        else if(!id.compare("rsm")) buildRoom(mirrorMat);
+        else if(!id.compare("rsglas")) buildRoom(glassMat);
+        else if(!id.compare("rsglos")) buildRoom(glossyMat);
+        else if(!id.compare("lights")) buildMultiLights();
+        else if(!id.compare("meshs")) buildMultiMeshs();
+        else if(!id.compare("outdoor")) buildOutdor();
+        else if(!id.compare("pool")) buildPool();
+        else if(!id.compare("mg")) buildMirrorGlass();
+        else if(!id.compare("sphere")) buildSphere();
+        else if(!id.compare("mesh"))
+            buildMesh(meshPath, grey);
+        else printUsage(argv[0]);
+    }
 
     updateBoundingBox();
+    bvh.build();
     setChanged(OBJECT_CHANGED);
     setChanged(LIGHT_CHANGED);
     setChanged(MATERIAL_CHANGED);
@@ -168,7 +175,7 @@ void Scene::updateBoundingBox () {
     else {
         for (const Object *o : objects) {
             if (o->isEnabled()) {
-                bbox.extendTo(o->getBoundingBox().translate(o->getTrans()));
+                bbox.extendTo(o->getWorldBoundingBox());
             }
         }
     }
@@ -180,22 +187,24 @@ void Scene::buildRoom(Material *sphereMat) {
     groundMesh.loadOFF("models/ground.off");
     groundMesh.setSquareTextureMapping();
 
-    objects.push_back(new Object(groundMesh, white, "Ground"));
+    // Walls are the ground turned around
+    auto ground = make_shared<Shape>(groundMesh);
+    objects.push_back(new Object(ground, white, "Ground"));
 
-    groundMesh.rotate({0,1,0}, M_PI);
-    objects.push_back(new Object(groundMesh, white, "Ceiling", {0, 0, 4}));
+    Matrix rotation = Matrix::rotation({0,1,0}, M_PI);
+    objects.push_back(new Object(ground, white, "Ceiling", {0, 0, 4}, rotation));
 
-    groundMesh.rotate({0,1,0}, M_PI/2);
-    objects.push_back(new Object(groundMesh, red, "Right Wall", {2, 0, 2}));
+    rotation = Matrix::rotation({0,1,0}, M_PI/2)*rotation;
+    objects.push_back(new Object(ground, red, "Right Wall", {2, 0, 2}, rotation));
 
-    groundMesh.rotate({0,0,1}, M_PI/2);
-    objects.push_back(new Object(groundMesh, green, "Back Wall", {0, 2, 2}));
+    rotation = Matrix::rotation({0,0,1}, M_PI/2)*rotation;
+    objects.push_back(new Object(ground, green, "Back Wall", {0, 2, 2}, rotation));
 
-    groundMesh.rotate({0,0,1}, M_PI/2);
-    objects.push_back(new Object(groundMesh, blue, "Left Wall", {-2, 0, 2}));
+    rotation = Matrix::rotation({0,0,1}, M_PI/2)*rotation;
+    objects.push_back(new Object(ground, blue, "Left Wall", {-2, 0, 2}, rotation));
 
-    groundMesh.rotate({0,0,1}, M_PI/2);
-    objects.push_back(new Object(groundMesh, black, "Front Wall", {0, -2, 2}));
+    rotation = Matrix::rotation({0,0,1}, M_PI/2)*rotation;
+    objects.push_back(new Object(ground, black, "Front Wall", {0, -2, 2}, rotation));
 
     if(sphereMat) {
         Mesh sphereMesh;
@@ -216,7 +225,7 @@ void Scene::buildRoom(Material *sphereMat) {
 void Scene::buildMesh(const std::string & path, Material *mat) {
     Mesh mesh;
     mesh.loadOFF(path);
-    mesh.scale(1.f/Object::computeBoundingBox(mesh).getRadius());
+    mesh.scale(1.f/Shape::computeBoundingBox(mesh).getRadius());
     objects.push_back(new Object(mesh, mat, path));
 
     lights.push_back(new Light({1.f, 1.f, 1.f}, 0.01, {0.f, 0.f, 1.f},
@@ -269,10 +278,11 @@ void Scene::buildMultiMeshs() {
     wallMesh.rotate({0, 1, 0}, M_PI/2.0);
     wallMesh.scale(2.0*1.95251, 1);
     wallMesh.scale(3, 2);
-    objects.push_back(new Object(wallMesh, mirrorMat, "Left wall", {-1.95251f, 0.f, 1.5}));
+    auto wall = make_shared<Shape>(wallMesh);
+    objects.push_back(new Object(wall, mirrorMat, "Left wall", {-1.95251f, 0.f, 1.5}));
 
-    wallMesh.rotate({0, 0, 1}, 3.0*M_PI/2.0);
-    objects.push_back(new Object(wallMesh, red, "Back wall", {0.f, 1.95251f, 1.5}));
+    objects.push_back(new Object(wall, red, "Back wall", {0.f, 1.95251f, 1.5},
+                                 Matrix::rotation({0, 0, 1}, 3.0*M_PI/2.0)));
 
     Mesh ramMesh;
     ramMesh.loadOFF("models/ram.off");
@@ -337,13 +347,15 @@ void Scene::buildPool() {
     Mesh sphereMesh;
     sphereMesh.loadOFF("models/sphere.off");
 
-    const float height = Object::computeBoundingBox(sphereMesh).getHeight()/2;
+    const float height = Shape::computeBoundingBox(sphereMesh).getHeight()/2;
     const float delta = sqrt(3.f)*height;
     groundMesh.scale(height*15);
 
     objects.push_back(new Object(groundMesh, pool, "Pool"));
     materials.push_back(pool);
 
+    auto ballShape = make_shared<Shape>(sphereMesh);
+
     for(int i = 0 ; i < 5 ; i++)
         for(int j = 0 ; j <= i ; j++) {
             unsigned ballId = (i*(i+1))/2+j;
@@ -356,7 +368,7 @@ void Scene::buildPool() {
                                      1.f, 1.f, ballTexture,
                                      basicNormal, .1f, 50);
             materials.push_back(ball);
-            objects.push_back(new Object(sphereMesh, ball, "Ball #"+numberConvert.str(), {-i*delta, (2*j-i)*height, height}));
+            objects.push_back(new Object(ballShape, ball, "Ball #"+numberConvert.str(), {-i*delta, (2*j-i)*height, height}));
         }
 
     lights.push_back(new Light({5.f, 5.f, 20.f}, 0.01, {0.f, 0.f, 1.f},
@@ -376,13 +388,14 @@ void Scene::buildSphere() {
     Mesh sphereMesh;
     sphereMesh.loadOFF("models/sphere.off");
     sphereMesh.scale(rayon);
-    auto sphere1 = new Object(sphereMesh, red, "Sphere1", {0, 0, rayon});
+    auto sphere = make_shared<Shape>(sphereMesh);
+    auto sphere1 = new Object(sphere, red, "Sphere1", {0, 0, rayon});
     objects.push_back(sphere1);
 
-    auto sphere2 = new Object(sphereMesh, green, "Sphere2", {2*rayon, 0, rayon});
+    auto sphere2 = new Object(sphere, green, "Sphere2", {2*rayon, 0, rayon});
     objects.push_back(sphere2);
 
-    auto sphere3 = new Object(sphereMesh, blue, "Sphere3", {-2*rayon, 0, rayon});
+    auto sphere3 = new Object(sphere, blue, "Sphere3", {-2*rayon, 0, rayon});
     objects.push_back(sphere3);
 
     lights.push_back(new Light({0.f, -1.f, 0.3f}, 0.01, {0.f, 0.f, 1.f},
@@ -427,39 +440,41 @@ void Scene::buildMirrorGlass() {
     groundMesh.loadOFF("models/ground.off");
     groundMesh.setSquareTextureMapping();
 
-    objects.push_back(new Object(groundMesh, groundMat, "Ground"));
+    auto ground = make_shared<Shape>(groundMesh);
+    objects.push_back(new Object(ground, groundMat, "Ground"));
 
-    groundMesh.rotate({0,1,0}, M_PI);
-    objects.push_back(new Object(groundMesh, grey, "Ceiling", {0, 0, 4}));
+    Matrix rotation = Matrix::rotation({0,1,0}, M_PI);
+    objects.push_back(new Object(ground, grey, "Ceiling", {0, 0, 4}, rotation));
 
-    groundMesh.rotate({0,1,0}, M_PI/2);
-    objects.push_back(new Object(groundMesh, wallMat, "Right Wall", {2, 0, 2}));
+    rotation = Matrix::rotation({0,1,0}, M_PI/2)*rotation;
+    objects.push_back(new Object(ground, wallMat, "Right Wall", {2, 0, 2}, rotation));
 
-    groundMesh.rotate({0,0,1}, M_PI/2);
-    objects.push_back(new Object(groundMesh, wallMat, "Back Wall", {0, 2, 2}));
+    rotation = Matrix::rotation({0,0,1}, M_PI/2)*rotation;
+    objects.push_back(new Object(ground, wallMat, "Back Wall", {0, 2, 2}, rotation));
 
-    groundMesh.rotate({0,0,1}, M_PI/2);
-    objects.push_back(new Object(groundMesh, wallMat, "Left Wall", {-2, 0, 2}));
+    rotation = Matrix::rotation({0,0,1}, M_PI/2)*rotation;
+    objects.push_back(new Object(ground, wallMat, "Left Wall", {-2, 0, 2}, rotation));
 
-    groundMesh.rotate({0,0,1}, M_PI/2);
-    objects.push_back(new Object(groundMesh, mirrorMat, "Mirror Wall", {0, -2, 2}));
+    rotation = Matrix::rotation({0,0,1}, M_PI/2)*rotation;
+    objects.push_back(new Object(ground, mirrorMat, "Mirror Wall", {0, -2, 2}, rotation));
 
     Mesh sphereMesh;
     sphereMesh.loadOFF("models/sphere.off");
+    auto sphere = make_shared<Shape>(sphereMesh);
 
-    objects.push_back(new Object(sphereMesh, groundMat, "Pedestal"));
+    objects.push_back(new Object(sphere, groundMat, "Pedestal"));
 
     Mesh ramMesh;
     ramMesh.loadOFF("models/ram.off");
     objects.push_back(new Object(ramMesh, ramMat, "Ram", {0.f, 0.f, .85f}));
 
-    sphereMesh.scale(0.5);
-    objects.push_back(new Object(sphereMesh, mirrorMat, "Mirror1", {-1 , 2, 1}));
-    objects.push_back(new Object(sphereMesh, mirrorMat, "Mirror2", {1 , 2, 1}));
-    objects.push_back(new Object(sphereMesh, mirrorMat, "Mirror2", {0 , 2, 1.f+sqrt(3.f)}));
+    const Matrix half = Matrix::scale(0.5f);
+    objects.push_back(new Object(sphere, mirrorMat, "Mirror1", {-1 , 2, 1}, half));
+    objects.push_back(new Object(sphere, mirrorMat, "Mirror2", {1 , 2, 1}, half));
+    objects.push_back(new Object(sphere, mirrorMat, "Mirror2", {0 , 2, 1.f+sqrt(3.f)}, half));
 
 
-    auto glass = new Object(sphereMesh, glassMat, "glass", {1 , 1, 3});
+    auto glass = new Object(sphere, glassMat, "glass", {1 , 1, 3}, half);
     objects.push_back(glass);
 
     lights.push_back(new Light({-1.9f, 0, 2.5f}, 0.5, {1.f, 0.f, 0.f},
@@ -12,6 +12,7 @@
 #include <vector>
 
 #include "Object.h"
+#include "BVH.h"
 #include "Light.h"
 #include "BoundingBox.h"
 #include "Vec3D.h"
@@ -62,15 +63,9 @@ public:
         return false;
     }
 
-    void move(unsigned nbImages) {
-        for (auto o : objects)
-            o->move(nbImages);
-    }
-
-    void reset() {
-        for (auto o : objects)
-            o->reset();
-    }
+    inline const BVH & getBVH() const { return bvh; }
+    /** To call once objects were added, moved or reshaped */
+    void updateBVH() { bvh.update(); }
 
     Scene(Controller *, int argc, char **argv);
     virtual ~Scene ();
@@ -110,6 +105,7 @@ private:
     void buildMesh(const std::string & path, Material *mat);
     std::vector<Object *> objects;
     std::vector<Light *> lights;
+    BVH bvh;
 
     NoiseColorTexture *poolTexture;
     SingleColorTexture *whiteTexture;
@@ -1,21 +1,14 @@
 #include "Shadow.h"
 
 #include "RayTracer.h"
-#include "Material.h"
 
 using namespace std;
 
 bool Shadow::hard(const Vec3Df & pos, const Vec3Df& light) const {
-    Ray riShadow;
-
     Vec3Df dir = light - pos;
     float dist = dir.normalize();
 
-    bool inter = rt->intersect(dir, pos, riShadow);
-    if(inter && dynamic_cast<const Glass *>(&riShadow.getIntersectedObject()->getMaterial()))
-        return true;
-
-    return !inter || (inter && riShadow.getIntersectionDistance() > dist);
+    return !rt->occlude(dir, pos, dist, true);
 }
 
 float Shadow::soft(const Vec3Df & pos, const Light & light) const {
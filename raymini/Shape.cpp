@@ -0,0 +1,29 @@
+#include "Shape.h"
+
+using namespace std;
+
+BoundingBox Shape::computeBoundingBox(const Mesh & mesh) {
+    BoundingBox bbox;
+    const vector<Vertex> & V = mesh.getVertices ();
+    if (V.empty ())
+        bbox = BoundingBox ();
+    else {
+        bbox = BoundingBox (V[0].getPos ());
+        for (unsigned int i = 1; i < V.size (); i++)
+            bbox.extendTo (V[i].getPos ());
+    }
+    return bbox;
+}
+
+void Shape::updateKDtree() {
+    updateBoundingBox();
+    if (tree) {
+        delete tree;
+    }
+    tree = new KDtree(*this, heuristic);
+}
+
+void Shape::refitKDtree(const KDtree::AxisMap &map) {
+    updateBoundingBox();
+    tree->refit(map);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <omp.h>
+
+#include "Mesh.h"
+#include "BoundingBox.h"
+#include "KDtree.h"
+
+/**
+ * Mesh with its bounding box and KDtree, in object space
+ * Several objects may draw the same shape, each with its own transform
+ */
+class Shape {
+public:
+    Shape(const Mesh & mesh, KDtree::Heuristic heuristic=KDtree::SAH):
+        mesh(mesh), heuristic(heuristic), tree(nullptr) {
+        updateBoundingBox();
+        // Built concurrently with other shapes inside a parallel region, see Scene
+        #pragma omp task if(omp_in_parallel())
+        tree = new KDtree(*this, heuristic);
+    }
+
+    ~Shape() {
+        delete tree;
+    }
+
+    inline const Mesh & getMesh() const { return mesh; }
+    /** Call updateKDtree or refitKDtree once changed */
+    inline Mesh & getMesh() { return mesh; }
+
+    inline const KDtree & getKDtree() const { return *tree; }
+
+    inline KDtree::Heuristic getHeuristic() const { return heuristic; }
+    /** Call updateKDtree to take it into account */
+    inline void setHeuristic(KDtree::Heuristic h) { heuristic = h; }
+
+    inline const BoundingBox & getBoundingBox() const { return bbox; }
+    void updateBoundingBox() { bbox = computeBoundingBox(mesh); }
+    static BoundingBox computeBoundingBox(const Mesh & mesh);
+
+    void updateKDtree();
+    /** Faster than updateKDtree after moving vertices, map tells how they moved */
+    void refitKDtree(const KDtree::AxisMap &map);
+
+private:
+    Mesh mesh;
+    BoundingBox bbox;
+    KDtree::Heuristic heuristic;
+    KDtree *tree;
+
+    // The KDtree refers to its shape
+    Shape(const Shape &) = delete;
+    Shape & operator=(const Shape &) = delete;
+};
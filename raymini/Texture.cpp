@@ -39,7 +39,8 @@ T MappedTexture<T>::getValue(Ray *intersectingRay) const {
     float interU = uC + uCA * interCA + uCB * interCB;
     float interV = vC + vCA * interCA + vCB * interCB;
 
-    const Mesh &mesh = intersectingRay->getIntersectedObject()->getMesh();
+    const Object *o = intersectingRay->getIntersectedObject();
+    const Mesh &mesh = o->getMesh();
 
     adaptUV(interU, interV, mesh.getUScale(), mesh.getVScale());
 
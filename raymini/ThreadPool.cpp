@@ -0,0 +1,58 @@
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned nbThreads):
+    job(nullptr),
+    generation(0),
+    nbWorking(0),
+    stopping(false)
+{
+    for(unsigned t = 1; t < max(nbThreads, 1u); t++)
+        threads.push_back(thread(&ThreadPool::work, this, t));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for(thread & t : threads)
+        t.join();
+}
+
+void ThreadPool::run(const function<void(unsigned)> & job) {
+    lock_guard<std::mutex> runLock(runMutex);
+    {
+        lock_guard<std::mutex> lock(mutex);
+        this->job = &job;
+        nbWorking = threads.size();
+        generation++;
+    }
+    wakeUp.notify_all();
+    job(0);
+
+    unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() {return nbWorking == 0;});
+    this->job = nullptr;
+}
+
+void ThreadPool::work(unsigned thread) {
+    unsigned lastGeneration = 0;
+    unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        wakeUp.wait(lock, [&]() {return stopping || generation != lastGeneration;});
+        if(stopping)
+            return;
+        lastGeneration = generation;
+        const function<void(unsigned)> & j = *job;
+        lock.unlock();
+        j(thread);
+        lock.lock();
+        if(--nbWorking == 0)
+            done.notify_one();
+    }
+}
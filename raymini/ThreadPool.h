@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * Threads kept for the whole program, rendering a frame only wakes them up
+ * RenderThread is a new thread for each frame, an omp parallel region it opens
+ * would start a new team of threads each time
+ */
+class ThreadPool {
+public:
+    /** The thread calling run is one of the nbThreads */
+    ThreadPool(unsigned nbThreads);
+    ~ThreadPool();
+
+    unsigned getNbThreads() const {return threads.size() + 1;}
+
+    /**
+     * Run job(thread) on each thread, thread being its index, and wait for all of them
+     * Jobs run at the same time from different threads are queued
+     */
+    void run(const std::function<void(unsigned)> & job);
+
+private:
+    std::vector<std::thread> threads;
+    /** Held for a whole job */
+    std::mutex runMutex;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable done;
+    /** Job of the current generation, threads wait for the next one */
+    const std::function<void(unsigned)> *job;
+    unsigned generation;
+    unsigned nbWorking;
+    bool stopping;
+
+    void work(unsigned thread);
+};
@@ -0,0 +1,88 @@
+#include <algorithm>
+
+#include "TileScheduler.h"
+
+using namespace std;
+
+/** Bits of x spread to the even bits */
+static inline uint32_t spread(uint32_t x) {
+    x &= 0xffff;
+    x = (x | x << 8) & 0x00ff00ff;
+    x = (x | x << 4) & 0x0f0f0f0f;
+    x = (x | x << 2) & 0x33333333;
+    x = (x | x << 1) & 0x55555555;
+    return x;
+}
+
+TileScheduler::TileScheduler(unsigned width, unsigned height, unsigned nbThreads):
+    runs(max(nbThreads, 1u))
+{
+    const unsigned nbX = (width + TILE_SIZE - 1)/TILE_SIZE;
+    const unsigned nbY = (height + TILE_SIZE - 1)/TILE_SIZE;
+    vector<pair<uint32_t, Tile>> ordered;
+    ordered.reserve(nbX*nbY);
+    for(unsigned y = 0; y < nbY; y++) {
+        for(unsigned x = 0; x < nbX; x++) {
+            const Tile tile = {x*TILE_SIZE, y*TILE_SIZE,
+                               min(TILE_SIZE, width - x*TILE_SIZE), min(TILE_SIZE, height - y*TILE_SIZE)};
+            ordered.push_back({spread(x) | spread(y) << 1, tile});
+        }
+    }
+    sort(ordered.begin(), ordered.end(),
+         [](const pair<uint32_t, Tile> & a, const pair<uint32_t, Tile> & b) {return a.first < b.first;});
+    tiles.reserve(ordered.size());
+    for(const auto & o : ordered)
+        tiles.push_back(o.second);
+
+    const unsigned nbRuns = runs.size();
+    for(unsigned t = 0; t < nbRuns; t++)
+        runs[t].bounds.store(pack(tiles.size()*t/nbRuns, tiles.size()*(t + 1)/nbRuns), memory_order_relaxed);
+}
+
+bool TileScheduler::next(unsigned thread, Tile & tile) {
+    if(thread >= runs.size())
+        return steal(thread, tile);
+
+    atomic<uint64_t> & bounds = runs[thread].bounds;
+    uint64_t b = bounds.load(memory_order_acquire);
+    while(getFirst(b) < getLast(b)) {
+        if(bounds.compare_exchange_weak(b, pack(getFirst(b) + 1, getLast(b)), memory_order_acq_rel)) {
+            tile = tiles[getFirst(b)];
+            return true;
+        }
+    }
+    return steal(thread, tile);
+}
+
+bool TileScheduler::steal(unsigned thread, Tile & tile) {
+    while(true) {
+        // Longest run left
+        unsigned victim = 0;
+        uint64_t victimBounds = 0;
+        uint32_t longest = 0;
+        for(unsigned t = 0; t < runs.size(); t++) {
+            const uint64_t b = runs[t].bounds.load(memory_order_acquire);
+            if(getFirst(b) < getLast(b) && getLast(b) - getFirst(b) > longest) {
+                victim = t;
+                victimBounds = b;
+                longest = getLast(b) - getFirst(b);
+            }
+        }
+        if(!longest)
+            return false;
+
+        // Its back half, the owner keeps taking from the front
+        // A thread without a run of its own takes a single tile
+        const uint32_t first = getFirst(victimBounds);
+        const uint32_t last = getLast(victimBounds);
+        const bool hasRun = thread < runs.size();
+        const uint32_t middle = hasRun ? first + (last - first)/2 : last - 1;
+        if(!runs[victim].bounds.compare_exchange_strong(victimBounds, pack(first, middle), memory_order_acq_rel))
+            continue;
+        tile = tiles[middle];
+        // Nobody touches an empty run, the rest of the stolen half becomes ours
+        if(hasRun)
+            runs[thread].bounds.store(pack(middle + 1, last), memory_order_release);
+        return true;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Tiles of a picture in Morton order, shared out among threads in contiguous runs
+ * A thread done with its run steals the back half of the longest run left,
+ * so neighbouring tiles stay on the same thread and no thread idles while others work
+ */
+class TileScheduler {
+public:
+    /** Pixels of a side of a tile, a multiple of the packet dimensions */
+    static const unsigned TILE_SIZE = 16;
+
+    struct Tile {
+        unsigned x, y;
+        unsigned width, height;
+    };
+
+    /** Runs for nbThreads, threads beyond them only steal */
+    TileScheduler(unsigned width, unsigned height, unsigned nbThreads);
+
+    unsigned getNbTiles() const {return tiles.size();}
+
+    /** Take a tile for thread, false once all are taken */
+    bool next(unsigned thread, Tile & tile);
+
+private:
+    std::vector<Tile> tiles;
+
+    /** Tiles [first, last) left to a thread, first in the high half, alone on its cache line */
+    struct Run {
+        std::atomic<uint64_t> bounds;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+    std::vector<Run> runs;
+
+    static inline uint64_t pack(uint32_t first, uint32_t last) {return uint64_t(first) << 32 | last;}
+    static inline uint32_t getFirst(uint64_t bounds) {return bounds >> 32;}
+    static inline uint32_t getLast(uint64_t bounds) {return uint32_t(bounds);}
+
+    bool steal(unsigned thread, Tile & tile);
+};
@@ -141,6 +141,7 @@ void Window::update(const Observable *observable) {
     updateShadows(observable);
     updateAntiAliasing(observable);
     updatePathTracing(observable);
+    updatePBGI(observable);
     updateBackgroundColor(observable);
 }
 
@@ -205,6 +206,18 @@ void Window::updateAmbientOcclusion(const Observable *observable) {
     }
 }
 
+void Window::updatePBGI(const Observable *observable) {
+    const PBGI *pbgi = controller->getPBGI();
+    if (observable != pbgi || !pbgi->isChanged(PBGI::PBGI_CHANGED)) {
+        return;
+    }
+    PBGIGatherComboBox->setCurrentIndex(pbgi->getGather());
+    PBGICutRatioSpinBox->disconnect();
+    PBGICutRatioSpinBox->setValue(pbgi->getCutRatio());
+    connect(PBGICutRatioSpinBox, SIGNAL(valueChanged(double)),
+            controller, SLOT(windowSetPBGICutRatio(double)));
+}
+
 void Window::updatePathTracing(const Observable *observable) {
     const RayTracer *rayTracer = controller->getRayTracer();
     if (observable != rayTracer) {
@@ -219,6 +232,19 @@ void Window::updatePathTracing(const Observable *observable) {
         PTNbRaySpinBox->setVisible(isPT);
         PTOnlyCheckBox->setVisible(isPT);
         PBGICheckBox->setVisible(!isPT);
+        photonMappingCheckBox->setVisible(!isPT);
+    }
+    if (rayTracer->isChanged(RayTracer::MODE_CHANGED)) {
+        PBGICheckBox->setChecked(rayTracer->getMode() == RayTracer::PBGI_MODE);
+        photonMappingCheckBox->setChecked(rayTracer->getMode() == RayTracer::PHOTON_MAPPING_MODE);
+    }
+    if (rayTracer->isChanged(RayTracer::DEPTH_PT_CHANGED | RayTracer::MODE_CHANGED)) {
+        bool isPBGI = rayTracer->getDepthPathTracing() == 0 && rayTracer->getMode() == RayTracer::PBGI_MODE;
+        PBGIGatherComboBox->setVisible(isPBGI);
+        PBGICutRatioSpinBox->setVisible(isPBGI);
+    }
+    if (rayTracer->isChanged(RayTracer::IRRADIANCE_CACHE_CHANGED)) {
+        irradianceCacheCheckBox->setChecked(rayTracer->isIrradianceCaching());
     }
     if (rayTracer->isChanged(RayTracer::NB_RAYS_PT_CHANGED)) {
         PTNbRaySpinBox->disconnect();
@@ -796,7 +822,8 @@ void Window::updateMapping(const Observable *observable) {
         updateList<Object>(mappingObjectsList, scene->getObjects(), index+1, "object");
     }
     if (isSelected && (selectedObjectChanged || sceneChanged)) {
-        const Mesh &mesh = scene->getObjects()[index]->getMesh();
+        const Object *o = scene->getObjects()[index];
+        const Mesh &mesh = o->getMesh();
         mappingUScale->disconnect();
         mappingUScale->setValue(mesh.getUScale());
         connect(mappingUScale, SIGNAL(valueChanged(double)),
@@ -968,6 +995,28 @@ void Window::initControlWidget() {
     connect (PBGICheckBox, SIGNAL (clicked (bool)), controller, SLOT (windowSetRayTracerMode (bool)));
     PTLayout->addWidget (PBGICheckBox);
 
+    PBGIGatherComboBox = new QComboBox(PTGroupBox);
+    PBGIGatherComboBox->addItem("Gather by ray casting");
+    PBGIGatherComboBox->addItem("Gather in a micro-buffer");
+    connect(PBGIGatherComboBox, SIGNAL(activated(int)), controller, SLOT(windowSetPBGIGather(int)));
+    PTLayout->addWidget(PBGIGatherComboBox);
+
+    PBGICutRatioSpinBox = new QDoubleSpinBox(PTGroupBox);
+    PBGICutRatioSpinBox->setPrefix ("Cut ratio: ");
+    PBGICutRatioSpinBox->setMinimum (0.0);
+    PBGICutRatioSpinBox->setMaximum (16.0);
+    PBGICutRatioSpinBox->setSingleStep(0.25);
+    connect(PBGICutRatioSpinBox, SIGNAL(valueChanged(double)), controller, SLOT(windowSetPBGICutRatio(double)));
+    PTLayout->addWidget (PBGICutRatioSpinBox);
+
+    photonMappingCheckBox = new QCheckBox ("Photon mapping mode", PTGroupBox);
+    connect (photonMappingCheckBox, SIGNAL (clicked (bool)), controller, SLOT (windowSetPhotonMapping (bool)));
+    PTLayout->addWidget (photonMappingCheckBox);
+
+    irradianceCacheCheckBox = new QCheckBox ("Irradiance cache", PTGroupBox);
+    connect (irradianceCacheCheckBox, SIGNAL (clicked (bool)), controller, SLOT (windowSetIrradianceCaching (bool)));
+    PTLayout->addWidget (irradianceCacheCheckBox);
+
     rayTabs->addTab(PTGroupBox, "Path Tracing");
 
     //  RayGroup: Focal
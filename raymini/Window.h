@@ -73,6 +73,7 @@ private :
     void updateAntiAliasing(const Observable *);
     void updateAmbientOcclusion(const Observable *);
     void updatePathTracing(const Observable *);
+    void updatePBGI(const Observable *);
     void updateBackgroundColor(const Observable *);
 
     QActionGroup * actionGroup;
@@ -115,6 +116,10 @@ private :
     QSpinBox *PTNbRaySpinBox;
     QCheckBox *PTOnlyCheckBox;
     QCheckBox *PBGICheckBox;
+    QComboBox *PBGIGatherComboBox;
+    QDoubleSpinBox *PBGICutRatioSpinBox;
+    QCheckBox *photonMappingCheckBox;
+    QCheckBox *irradianceCacheCheckBox;
     QDoubleSpinBox * PTIntensitySpinBox;
 
     QSpinBox *AANbRaySpinBox;
@@ -13,11 +13,14 @@ HEADERS = Window.h \
           BoundingBox.h \
           Material.h \
           Object.h \
+          Shape.h \
+          Matrix.h \
           Light.h \
           Scene.h \
           RayTracer.h \
           Ray.h \
           KDtree.h \
+          KDtreeCache.h \
           Noise.h \
           AntiAliasing.h \
           Color.h \
@@ -36,7 +39,16 @@ HEADERS = Window.h \
           NoiseUser.h \
           Brdf.h \
           PBGI.h \
-          Octree.h
+          MicroBuffer.h \
+          IrradianceCache.h \
+          PhotonMap.h \
+          PhotonMapping.h \
+          TileScheduler.h \
+          ThreadPool.h \
+          FrameBuffer.h \
+          Octree.h \
+          BVH.h \
+          RayPacket.h
 
 SOURCES = Window.cpp \
           GLViewer.cpp \
@@ -47,11 +59,13 @@ SOURCES = Window.cpp \
           BoundingBox.cpp \
           Material.cpp \
           Object.cpp \
+          Shape.cpp \
           Light.cpp \
           Scene.cpp \
           RayTracer.cpp \
           Ray.cpp \
           KDtree.cpp \
+          KDtreeCache.cpp \
           Brdf.cpp \
           Noise.cpp \
           AntiAliasing.cpp \
@@ -66,8 +80,15 @@ SOURCES = Window.cpp \
           PointCloud.cpp \
           Octree.cpp \
           RenderThread.cpp \
-          ProgressBar.cpp \
           PBGI.cpp \
+          MicroBuffer.cpp \
+          IrradianceCache.cpp \
+          PhotonMap.cpp \
+          PhotonMapping.cpp \
+          TileScheduler.cpp \
+          ThreadPool.cpp \
+          FrameBuffer.cpp \
+          BVH.cpp \
           Main.cpp
 
     DESTDIR=.